@@ -0,0 +1,678 @@
+/// S2E Selective Symbolic Execution Platform
+///
+/// Copyright (c) 2017 Cyberhaven
+///
+/// Permission is hereby granted, free of charge, to any person obtaining a copy
+/// of this software and associated documentation files (the "Software"), to deal
+/// in the Software without restriction, including without limitation the rights
+/// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+/// copies of the Software, and to permit persons to whom the Software is
+/// furnished to do so, subject to the following conditions:
+///
+/// The above copyright notice and this permission notice shall be included in all
+/// copies or substantial portions of the Software.
+///
+/// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+/// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+/// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+/// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+/// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+/// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+/// SOFTWARE.
+
+#ifndef S2E_HOSTFILES_H
+#define S2E_HOSTFILES_H
+
+#include <s2e/s2e.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bounds of the transfer chunk size
+#define S2E_CHUNK_SIZE_MIN (4 * 1024)
+#define S2E_CHUNK_SIZE_MAX (1024 * 1024)
+#define S2E_CHUNK_SIZE_DEFAULT (64 * 1024)
+
+// Number of chunks over which the throughput of a chunk size is measured
+#define S2E_CHUNK_PROBE_COUNT 4
+
+///
+/// \brief Picks the size of the chunks of a HostFiles transfer by measuring the throughput of the first chunks
+///
+/// The best size depends on the cost of each custom instruction on the host, on the cost of touching the buffer in
+/// the guest, and on the memory available to the guest. The tuner starts from the initial size and measures the
+/// throughput over S2E_CHUNK_PROBE_COUNT chunks. It then keeps doubling the size while this improves the throughput,
+/// or halving it if the first doubling did not help, and settles on the best size it saw.
+///
+struct s2e_chunk_tuner_t {
+    unsigned min;
+    unsigned max;
+
+    // Size of the next chunk
+    unsigned size;
+
+    // 0 while probing, 1 once the size is settled
+    int settled;
+
+    // 1 while growing the size, -1 while shrinking it
+    int direction;
+
+    unsigned initial;
+    unsigned best_size;
+    double best_rate;
+
+    // Measurement of the current size
+    unsigned chunks;
+    uint64_t bytes;
+    double start;
+};
+
+static inline double __s2e_chunk_tuner_time(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+///
+/// \brief Return the largest chunk size that is reasonable for the memory of the guest
+///
+static inline unsigned s2e_chunk_size_max(void) {
+    unsigned max = S2E_CHUNK_SIZE_MAX;
+#if !defined(_WIN32) && defined(_SC_PHYS_PAGES)
+    // Keep a chunk, and the pages that are touched for it, well under a percent of the memory
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0 && (uint64_t) pages * page_size / 256 < max) {
+        max = (uint64_t) pages * page_size / 256;
+    }
+#endif
+    return max < S2E_CHUNK_SIZE_MIN ? S2E_CHUNK_SIZE_MIN : max;
+}
+
+///
+/// \brief Initialize a chunk size tuner
+///
+/// \param t the tuner
+/// \param min the smallest chunk size to try
+/// \param max the largest chunk size to try
+/// \param fixed a chunk size to use without probing, or 0 to probe. This overrides the bounds.
+///
+static inline void s2e_chunk_tuner_init(struct s2e_chunk_tuner_t *t, unsigned min, unsigned max, unsigned fixed) {
+    memset(t, 0, sizeof(*t));
+
+    t->min = min;
+    t->max = max < min ? min : max;
+    t->direction = 1;
+
+    if (fixed) {
+        t->min = t->max = t->size = fixed;
+        t->settled = 1;
+    } else {
+        t->size = S2E_CHUNK_SIZE_DEFAULT;
+        t->size = t->size < t->min ? t->min : t->size > t->max ? t->max : t->size;
+        t->initial = t->size;
+    }
+}
+
+///
+/// \brief Account for a transferred chunk and pick the size of the next one
+///
+/// \param t the tuner
+/// \param bytes the number of bytes of the chunk
+/// \return 1 if the size was settled by this chunk, 0 otherwise
+///
+static inline int s2e_chunk_tuner_update(struct s2e_chunk_tuner_t *t, unsigned bytes) {
+    if (t->settled) {
+        return 0;
+    }
+
+    double now = __s2e_chunk_tuner_time();
+    if (t->chunks++ == 0) {
+        // The time spent before the first chunk is not part of the measurement
+        t->start = now;
+        return 0;
+    }
+
+    t->bytes += bytes;
+    if (t->chunks <= S2E_CHUNK_PROBE_COUNT) {
+        return 0;
+    }
+
+    double elapsed = now - t->start;
+    double rate = elapsed > 0 ? t->bytes / elapsed : (double) t->bytes * 1000000;
+
+    unsigned next = 0;
+    if (!t->best_size || rate > t->best_rate * 1.05) {
+        t->best_size = t->size;
+        t->best_rate = rate;
+        if (t->size == t->initial && t->size * 2 > t->max) {
+            // Growing is not possible, try smaller chunks instead
+            t->direction = -1;
+        }
+        next = t->direction > 0 ? t->size * 2 : t->size / 2;
+    } else if (t->direction > 0 && t->best_size == t->initial) {
+        // The first doubling did not help, try smaller chunks instead
+        t->direction = -1;
+        next = t->initial / 2;
+    }
+
+    if (!next || next < t->min || next > t->max) {
+        t->size = t->best_size;
+        t->settled = 1;
+        return 1;
+    }
+
+    t->size = next;
+    t->chunks = 0;
+    t->bytes = 0;
+    return 0;
+}
+
+///
+/// \brief Keep a buffer that is passed to S2E many times resident in memory
+///
+/// S2E cannot page in memory by itself, so the wrappers touch every page of a buffer before each call. Locking a hot
+/// buffer faults it in once, with writable pages, and keeps it from being paged out between calls. If the buffer
+/// cannot be locked, e.g., because of RLIMIT_MEMLOCK, its pages are write-faulted instead, so that they are at least
+/// not backed by the shared zero page.
+///
+/// \param buffer the buffer
+/// \param size the size of the buffer
+/// \return 0 if the buffer was locked, -1 if it was only faulted in
+///
+static inline int s2e_make_resident(void *buffer, size_t size) {
+#ifndef _WIN32
+    if (mlock(buffer, size) == 0) {
+        return 0;
+    }
+#endif
+
+    volatile char *b = (volatile char *) buffer;
+    for (size_t i = 0; i < size; i += S2E_PAGE_SIZE) {
+        b[i] = b[i];
+    }
+
+    return -1;
+}
+
+// Polynomial of CRC32C (Castagnoli) in reversed bit order
+#define S2E_CRC32C_POLY 0x82f63b78
+
+static uint32_t __s2e_crc32c_table[8][256];
+static int __s2e_crc32c_sse42;
+
+// 0 before initialization, 1 while a thread initializes, 2 once done
+static int __s2e_crc32c_state;
+
+///
+/// \brief Build the slicing-by-8 tables and detect the crc32 instruction on the first use
+///
+/// Programs that never compute a CRC32C do not pay for this at startup. It is safe to call from several threads:
+/// one of them does the work while the others wait for it.
+///
+static void __s2e_crc32c_init(void) {
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&__s2e_crc32c_state, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&__s2e_crc32c_state, __ATOMIC_ACQUIRE) != 2) {
+        }
+        return;
+    }
+
+    for (unsigned i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (unsigned j = 0; j < 8; ++j) {
+            crc = (crc >> 1) ^ (S2E_CRC32C_POLY & (0 - (crc & 1)));
+        }
+        __s2e_crc32c_table[0][i] = crc;
+    }
+
+    for (unsigned i = 0; i < 256; ++i) {
+        for (unsigned k = 1; k < 8; ++k) {
+            uint32_t prev = __s2e_crc32c_table[k - 1][i];
+            __s2e_crc32c_table[k][i] = (prev >> 8) ^ __s2e_crc32c_table[0][prev & 0xff];
+        }
+    }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    __s2e_crc32c_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+
+    __atomic_store_n(&__s2e_crc32c_state, 2, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t __s2e_crc32c_sw(uint32_t crc, const unsigned char *p, size_t size) {
+    uint32_t(*t)[256] = __s2e_crc32c_table;
+
+    while (size && ((uintptr_t) p & 7)) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+        --size;
+    }
+
+    // Guests are little endian
+    while (size >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+
+    while (size--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+
+    return crc;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+__attribute__((target("sse4.2"))) static inline uint32_t __s2e_crc32c_hw(uint32_t crc, const unsigned char *p,
+                                                                         size_t size) {
+    while (size && ((uintptr_t) p & 7)) {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+        --size;
+    }
+
+#ifdef __x86_64__
+    while (size >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = (uint32_t) __builtin_ia32_crc32di(crc, v);
+        p += 8;
+        size -= 8;
+    }
+#else
+    while (size >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = __builtin_ia32_crc32si(crc, v);
+        p += 4;
+        size -= 4;
+    }
+#endif
+
+    while (size--) {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    }
+
+    return crc;
+}
+#endif
+
+///
+/// \brief Update a CRC32C with more data
+///
+/// Uses the SSE4.2 crc32 instruction when the CPU has it, and slicing-by-8 tables otherwise.
+///
+/// \param crc the CRC32C of the preceding data, 0 for the first call
+/// \param buffer the data
+/// \param size the size of the data
+/// \return the CRC32C of the preceding data followed by the buffer
+///
+static inline uint32_t s2e_crc32c(uint32_t crc, const void *buffer, size_t size) {
+    const unsigned char *p = (const unsigned char *) buffer;
+
+    if (__atomic_load_n(&__s2e_crc32c_state, __ATOMIC_ACQUIRE) != 2) {
+        __s2e_crc32c_init();
+    }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__s2e_crc32c_sse42) {
+        return ~__s2e_crc32c_hw(~crc, p, size);
+    }
+#endif
+    return ~__s2e_crc32c_sw(~crc, p, size);
+}
+
+// Default size of the buffer of an s2e_FILE
+#define S2E_FILE_BUFFER_SIZE (256 * 1024)
+
+///
+/// \brief A buffered stream over a file of the HostFiles plugin
+///
+/// Reads are served from a buffer that is refilled with a single s2e_read of its whole size, and writes are
+/// collected in the buffer until it is full, so that small accesses do not each cost a custom instruction. Requests
+/// at least as large as the buffer bypass it, so that large transfers are not copied twice. A stream is either
+/// read or written, as the HostFiles plugin opens host files in one direction only.
+///
+/// A stream can also compute the CRC32C of the data that goes through it, see s2e_fcrc32c.
+///
+typedef struct s2e_FILE {
+    int fd;
+    int writing;
+
+    char *buf;
+    size_t size;
+
+    // Read position in the buffer, or amount of pending data when writing
+    size_t pos;
+
+    // Amount of data in the buffer when reading
+    size_t len;
+
+    int eof;
+    int error;
+
+    // CRC32C of the first crc_bytes bytes of the file, while crc_enabled is set
+    int crc_enabled;
+    int crc_seeked;
+    uint32_t crc;
+    uint64_t crc_bytes;
+} s2e_FILE;
+
+///
+/// \brief Wrap an open HostFiles descriptor in a stream
+///
+/// \param fd the descriptor, returned by s2e_open for reading or by s2e_create for writing
+/// \param mode "r" to read, "w" to write
+/// \param buffer_size the size of the buffer, 0 for an unbuffered stream
+/// \return the stream, or NULL if memory could not be allocated
+///
+static inline s2e_FILE *s2e_fdopen(int fd, const char *mode, size_t buffer_size) {
+    s2e_FILE *f = (s2e_FILE *) calloc(1, sizeof(*f));
+    if (!f) {
+        return NULL;
+    }
+
+    if (buffer_size && !(f->buf = (char *) malloc(buffer_size))) {
+        free(f);
+        return NULL;
+    }
+
+    f->fd = fd;
+    f->writing = mode[0] == 'w';
+    f->size = buffer_size;
+    return f;
+}
+
+///
+/// \brief Open a host file as a stream
+///
+/// \param path path of the file, relative to the HostFiles plugin base directory
+/// \param mode "r" to read an existing file, "w" to create a new one
+/// \return the stream, or NULL on failure
+///
+static inline s2e_FILE *s2e_fopen(const char *path, const char *mode) {
+    int fd = mode[0] == 'w' ? s2e_create(path) : s2e_open(path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    s2e_FILE *f = s2e_fdopen(fd, mode, S2E_FILE_BUFFER_SIZE);
+    if (!f) {
+        s2e_close(fd);
+    }
+
+    return f;
+}
+
+static inline int s2e_fflush(s2e_FILE *f) {
+    if (!f->writing) {
+        // Drop the data that was read ahead
+        f->pos = f->len = 0;
+        return 0;
+    }
+
+    size_t done = 0;
+    while (done < f->pos) {
+        int ret = s2e_write(f->fd, f->buf + done, f->pos - done);
+        if (ret <= 0) {
+            f->error = 1;
+            return -1;
+        }
+        done += ret;
+    }
+
+    f->pos = 0;
+    return 0;
+}
+
+///
+/// \brief Change the size of the buffer of a stream, like setvbuf
+///
+/// Pending writes are flushed and data that was read ahead is kept.
+///
+/// \param f the stream
+/// \param size the new size of the buffer, 0 for an unbuffered stream
+/// \return 0 on success, -1 on failure
+///
+static inline int s2e_setvbuf(s2e_FILE *f, size_t size) {
+    if (f->writing && s2e_fflush(f) < 0) {
+        return -1;
+    }
+
+    size_t pending = f->writing ? 0 : f->len - f->pos;
+    if (size < pending) {
+        return -1;
+    }
+
+    char *buf = NULL;
+    if (size && !(buf = (char *) malloc(size))) {
+        return -1;
+    }
+
+    if (buf && pending) {
+        memcpy(buf, f->buf + f->pos, pending);
+    }
+
+    free(f->buf);
+    f->buf = buf;
+    f->size = size;
+    f->pos = 0;
+    f->len = pending;
+    return 0;
+}
+
+///
+/// \brief Start computing the CRC32C of the data that goes through a stream
+///
+/// Must be called before anything is read from or written to the stream.
+///
+static inline void s2e_fcrc32c_start(s2e_FILE *f) {
+    f->crc_enabled = 1;
+    f->crc_seeked = 0;
+    f->crc = 0;
+    f->crc_bytes = 0;
+}
+
+static inline void __s2e_fcrc32c_update(s2e_FILE *f, const void *buf, size_t count) {
+    if (!f->crc_enabled) {
+        return;
+    }
+
+    // Data that does not directly follow the checksummed data makes the checksum useless
+    if (f->crc_seeked) {
+        f->crc_enabled = 0;
+        return;
+    }
+
+    f->crc = s2e_crc32c(f->crc, buf, count);
+    f->crc_bytes += count;
+}
+
+///
+/// \brief Get the CRC32C of the data that went through a stream since s2e_fcrc32c_start
+///
+/// \param f the stream
+/// \param crc receives the CRC32C of the first \c bytes bytes of the file
+/// \param bytes receives the number of bytes covered by the checksum
+/// \return 0 on success, -1 if the stream did not transfer a contiguous prefix of the file
+///
+static inline int s2e_fcrc32c(s2e_FILE *f, uint32_t *crc, uint64_t *bytes) {
+    if (!f->crc_enabled) {
+        return -1;
+    }
+
+    *crc = f->crc;
+    *bytes = f->crc_bytes;
+    return 0;
+}
+
+static inline size_t s2e_fread(void *ptr, size_t size, size_t nmemb, s2e_FILE *f) {
+    char *out = (char *) ptr;
+    size_t total = size * nmemb;
+    size_t done = 0;
+
+    while (done < total && !f->eof && !f->error) {
+        if (f->pos < f->len) {
+            size_t count = f->len - f->pos < total - done ? f->len - f->pos : total - done;
+            memcpy(out + done, f->buf + f->pos, count);
+            __s2e_fcrc32c_update(f, out + done, count);
+            f->pos += count;
+            done += count;
+            continue;
+        }
+
+        // Large reads go directly to the destination
+        int direct = total - done >= f->size;
+        size_t count = direct ? total - done : f->size;
+        if (count > INT_MAX) {
+            count = INT_MAX;
+        }
+
+        int ret = s2e_read(f->fd, direct ? out + done : f->buf, count);
+        if (ret < 0) {
+            f->error = 1;
+        } else if (ret == 0) {
+            f->eof = 1;
+        } else if (direct) {
+            __s2e_fcrc32c_update(f, out + done, ret);
+            done += ret;
+        } else {
+            f->pos = 0;
+            f->len = ret;
+        }
+    }
+
+    return size ? done / size : 0;
+}
+
+static inline size_t s2e_fwrite(const void *ptr, size_t size, size_t nmemb, s2e_FILE *f) {
+    const char *in = (const char *) ptr;
+    size_t total = size * nmemb;
+    size_t done = 0;
+
+    // Data that does not make it to the host is caught when the stream is flushed
+    __s2e_fcrc32c_update(f, in, total);
+
+    if (f->pos + total > f->size && s2e_fflush(f) < 0) {
+        return 0;
+    }
+
+    if (total >= f->size) {
+        // Large writes go directly to the host
+        while (done < total) {
+            int count = total - done > INT_MAX ? INT_MAX : total - done;
+            int ret = s2e_write(f->fd, (char *) in + done, count);
+            if (ret <= 0) {
+                f->error = 1;
+                break;
+            }
+            done += ret;
+        }
+    } else {
+        memcpy(f->buf + f->pos, in, total);
+        f->pos += total;
+        done = total;
+
+        if (f->pos == f->size && s2e_fflush(f) < 0) {
+            return 0;
+        }
+    }
+
+    return size ? done / size : 0;
+}
+
+///
+/// \brief Read a line from a stream, like fgets
+///
+static inline char *s2e_fgets(char *s, int n, s2e_FILE *f) {
+    int i = 0;
+
+    while (i < n - 1) {
+        char c;
+        if (s2e_fread(&c, 1, 1, f) != 1) {
+            break;
+        }
+
+        s[i++] = c;
+        if (c == '\n') {
+            break;
+        }
+    }
+
+    if (i == 0 || f->error) {
+        return NULL;
+    }
+
+    s[i] = 0;
+    return s;
+}
+
+///
+/// \brief Move the position of a stream, like fseek
+///
+/// Requires a HostFiles plugin that supports seeking.
+///
+/// \return the new position, or -1 on failure
+///
+static inline int64_t s2e_fseek(s2e_FILE *f, int64_t offset, int whence) {
+    // The position of the descriptor is ahead of the stream by the data that was read ahead
+    if (whence == SEEK_CUR && !f->writing) {
+        offset -= (int64_t)(f->len - f->pos);
+    }
+
+    if (s2e_fflush(f) < 0) {
+        return -1;
+    }
+
+    int64_t ret = s2e_seek(f->fd, offset, whence);
+    if (ret >= 0) {
+        f->eof = 0;
+    }
+
+    // The checksum stays valid if the stream comes back to where it stopped
+    f->crc_seeked = ret != (int64_t) f->crc_bytes;
+
+    return ret;
+}
+
+static inline int s2e_feof(s2e_FILE *f) {
+    return f->eof && f->pos == f->len;
+}
+
+static inline int s2e_ferror(s2e_FILE *f) {
+    return f->error;
+}
+
+///
+/// \brief Flush and close a stream
+///
+/// \return 0 on success, -1 if pending data could not be written
+///
+static inline int s2e_fclose(s2e_FILE *f) {
+    int ret = f->writing ? s2e_fflush(f) : 0;
+    s2e_close(f->fd);
+    free(f->buf);
+    free(f);
+    return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
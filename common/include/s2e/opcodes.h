@@ -48,6 +48,10 @@ extern "C" {
 #define HOST_FILES_READ_OPCODE              0x02
 #define HOST_FILES_CREATE_OPCODE            0x03
 #define HOST_FILES_WRITE_OPCODE             0x04
+#define HOST_FILES_LISTDIR_OPCODE           0x05
+#define HOST_FILES_SEEK_OPCODE              0x06
+#define HOST_FILES_STAT_OPCODE              0x07
+#define HOST_FILES_RENAME_OPCODE            0x08
 
 // Expression evaluates to true if the custom instruction operand contains the
 // specified opcode
@@ -77,6 +81,7 @@ extern "C" {
 #define BASE_S2E_MAKE_CONCOLIC  0x11 // Keep this for backwards compatibility, behaves like s2e_make_symbolic
 #define BASE_S2E_BEGIN_ATOMIC   0x12
 #define BASE_S2E_END_ATOMIC     0x13
+#define BASE_S2E_ASSUME_BUFFER  0x14
 #define BASE_S2E_CONCRETIZE     0x20
 #define BASE_S2E_EXAMPLE        0x21
 #define BASE_S2E_STATE_COUNT    0x30
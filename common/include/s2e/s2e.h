@@ -38,6 +38,11 @@
 #include <linux/types.h>
 #else
 #include <inttypes.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/select.h>
+#endif
 #endif
 
 #ifdef __cplusplus
@@ -92,23 +97,37 @@ static inline void __s2e_touch_string(volatile const char *string) {
     }
 }
 
+// Granularity at which buffers are paged in. Guest pages are at least this large.
+#define S2E_PAGE_SIZE 4096
+
 ///
-/// \brief Forces a read of each byte in the specified buffer
+/// \brief Forces a read of one byte in each page of the specified buffer
 ///
 /// This ensures that the memory pages occupied by the buffer are paged in memory before passing them to S2E, which
-/// cannot page in memory by itself.
+/// cannot page in memory by itself. Reading one byte per page is enough, a 64 KiB buffer takes 17 loads instead of
+/// 65536.
 ///
 /// \param[in] buffer Buffer to page into memory
 /// \param[in] size Number of bytes in the buffer
 ///
 static inline void __s2e_touch_buffer(volatile void *buffer, unsigned size) {
-    unsigned i;
+    unsigned i, pages;
     unsigned t __attribute__((unused));
-    volatile char *b = (volatile char *) buffer;
-    for (i = 0; i < size; ++i) {
-	t = *b;
-	++b;
+    uintptr_t start = (uintptr_t) buffer;
+    uintptr_t last = start + size - 1;
+
+    if (!size) {
+        return;
+    }
+
+    // Count the pages after the first one, so that the loop cannot wrap around at the end of the address space
+    pages = ((last & ~(uintptr_t)(S2E_PAGE_SIZE - 1)) - (start & ~(uintptr_t)(S2E_PAGE_SIZE - 1))) / S2E_PAGE_SIZE;
+
+    t = *(volatile char *) start;
+    for (i = 1; i <= pages; ++i) {
+        t = *(volatile char *) ((start & ~(uintptr_t)(S2E_PAGE_SIZE - 1)) + i * S2E_PAGE_SIZE);
     }
+    t = *(volatile char *) last;
 }
 
 ///
@@ -125,6 +144,51 @@ static inline int s2e_check(void) {
     return version;
 }
 
+#ifndef __KERNEL__
+
+// Longest interval between two checks of s2e_wait_for_mode, in microseconds
+#define S2E_WAIT_MAX_INTERVAL_US 10000
+
+///
+/// \brief Wait until the guest runs in S2E mode
+///
+/// The first checks are microseconds apart and the interval doubles up to S2E_WAIT_MAX_INTERVAL_US, so that waiting
+/// does not keep a vCPU busy and adds little latency once S2E mode is entered.
+///
+/// \param timeout_ms How long to wait in milliseconds, or a negative value to wait forever. The time spent is
+/// estimated from the requested sleeps, so the actual wait may be somewhat longer.
+/// \return The S2E version, or 0 if the timeout expired
+///
+static inline int s2e_wait_for_mode(int timeout_ms) {
+    uint64_t waited_us = 0;
+    unsigned interval_us = 1;
+    int version;
+
+    while (!(version = s2e_check())) {
+        if (timeout_ms >= 0 && waited_us >= (uint64_t) timeout_ms * 1000) {
+            return 0;
+        }
+
+#ifdef _WIN32
+        // Sleep has a resolution of a millisecond
+        unsigned sleep_ms = (interval_us + 999) / 1000;
+        Sleep(sleep_ms);
+        waited_us += sleep_ms * 1000;
+#else
+        // Unlike nanosleep and usleep, select is declared even in strict C99 builds
+        struct timeval tv = {(time_t)(interval_us / 1000000), (suseconds_t)(interval_us % 1000000)};
+        select(0, NULL, NULL, NULL, &tv);
+        waited_us += interval_us;
+#endif
+
+        interval_us = interval_us * 2 > S2E_WAIT_MAX_INTERVAL_US ? S2E_WAIT_MAX_INTERVAL_US : interval_us * 2;
+    }
+
+    return version;
+}
+
+#endif
+
 //
 // These functions allow you to print messages and symbolic values to the S2E log file. This is useful for debugging
 //
@@ -221,7 +285,7 @@ static inline void s2e_make_symbolic(void *buf, int size, const char *name) {
 ///
 static inline int s2e_is_symbolic(void *ptr, size_t size) {
     int result;
-    __s2e_touch_buffer(ptr, 1);
+    __s2e_touch_buffer(ptr, size);
     __asm__ __volatile__(
         S2E_INSTRUCTION_SIMPLE(BASE_S2E_IS_SYMBOLIC)
         : "=a" (result) : "a" (size), "c" (ptr)
@@ -458,6 +522,52 @@ static inline void s2e_assume_range(unsigned int expression, unsigned int lower,
     );
 }
 
+struct S2E_ASSUME_RANGE_BUFFER {
+    // Pointer to the buffer whose bytes are constrained
+    uint64_t buffer;
+    uint64_t size;
+
+    // Bounds of every byte, inclusive
+    uint8_t lower;
+    uint8_t upper;
+} __attribute__((packed));
+
+///
+/// \brief Adds a bounded constraint on every byte of a buffer to the current state
+///
+/// This has the same effect as calling \c s2e_assume_range on each byte, but takes a single custom instruction
+/// and adds a single constraint. If S2E does not support this instruction, the function falls back to calling
+/// \c s2e_assume_range on each byte. The constraints must be satisfiable.
+///
+/// \param[in] buffer The buffer whose bytes are constrained
+/// \param[in] size The size of the buffer
+/// \param[in] lower The lower bound of every byte
+/// \param[in] upper The upper bound of every byte
+///
+static inline void s2e_assume_range_buffer(const void *buffer, unsigned size, uint8_t lower, uint8_t upper) {
+    struct S2E_ASSUME_RANGE_BUFFER req;
+    const uint8_t *bytes = (const uint8_t *) buffer;
+    unsigned i;
+    int res;
+
+    req.buffer = (uintptr_t) buffer;
+    req.size = size;
+    req.lower = lower;
+    req.upper = upper;
+
+    __s2e_touch_buffer((volatile void *) buffer, size);
+    __asm__ __volatile__(
+        S2E_INSTRUCTION_SIMPLE(BASE_S2E_ASSUME_BUFFER)
+        : "=a" (res) : "a" (-1), "c" (&req) : "memory"
+    );
+
+    if (res == -1) {
+        for (i = 0; i < size; ++i) {
+            s2e_assume_range(bytes[i], lower, upper);
+        }
+    }
+}
+
 ///
 /// \brief Returns a symbolic value in a given range
 ///
@@ -660,6 +770,201 @@ static inline int s2e_write(int fd, char *buf, int count) {
     return res;
 }
 
+struct S2E_HOSTFILES_SEEK {
+    uint64_t fd;
+
+    // Requested offset. Updated with the resulting offset from the beginning of the file.
+    int64_t offset;
+
+    // One of SEEK_SET, SEEK_CUR or SEEK_END
+    uint64_t whence;
+} __attribute__((packed));
+
+///
+/// \brief Reposition the offset of a file on the host
+///
+/// Requires that the \c HostFiles plugin is enabled. Offsets are 64-bit wide on all guests, which allows
+/// ranged and resumed transfers of files larger than 2 GiB.
+///
+/// \param[in] fd File descriptor for the host file
+/// \param[in] offset The offset, interpreted according to \c whence
+/// \param[in] whence One of \c SEEK_SET, \c SEEK_CUR or \c SEEK_END
+/// \return The resulting offset from the beginning of the file, or -1 on error
+///
+static inline int64_t s2e_seek(int fd, int64_t offset, int whence) {
+    struct S2E_HOSTFILES_SEEK req;
+    int res;
+
+    req.fd = fd;
+    req.offset = offset;
+    req.whence = whence;
+
+    __asm__ __volatile__(
+        S2E_INSTRUCTION_COMPLEX(HOST_FILES_OPCODE, HOST_FILES_SEEK_OPCODE)
+        : "=a" (res) : "a" (-1), "c" (&req) : "memory"
+    );
+
+    return res < 0 ? -1 : req.offset;
+}
+
+struct S2E_HOSTFILES_STAT {
+    // Pointer to the file path
+    uint64_t path;
+
+    uint64_t size;
+
+    // Last modification time, in seconds since the epoch
+    uint64_t mtime;
+
+    // SHA-256 digest of the file contents, unless S2E_HOSTFILES_STAT_NO_DIGEST was set
+    uint8_t digest[32];
+
+    // CRC32C of the file contents, valid if flags has S2E_HOSTFILES_STAT_CRC32C
+    uint32_t crc32c;
+    uint32_t flags;
+} __attribute__((packed));
+
+// Set by the plugin when crc32c is valid
+#define S2E_HOSTFILES_STAT_CRC32C 1
+
+// Set by the caller to skip hashing the file contents
+#define S2E_HOSTFILES_STAT_NO_DIGEST 2
+
+///
+/// \brief Get the size, modification time and content digest of a file on the host
+///
+/// Requires that the \c HostFiles plugin is enabled. Plugins that do not compute the CRC32C leave \c flags
+/// untouched, so \c st should be cleared before the call.
+///
+/// \param[in] fname Path to the host file. This path must be relative to the \c HostFiles plugin base directory
+/// \param[out] st Receives the file information
+/// \return 0 on success, -1 on error
+///
+static inline int s2e_stat(const char *fname, struct S2E_HOSTFILES_STAT *st) {
+    int res;
+
+    st->path = (uintptr_t) fname;
+
+    __s2e_touch_string(fname);
+    __s2e_touch_buffer(st, sizeof(*st));
+    __asm__ __volatile__(
+        S2E_INSTRUCTION_COMPLEX(HOST_FILES_OPCODE, HOST_FILES_STAT_OPCODE)
+        : "=a" (res) : "a" (-1), "c" (st) : "memory"
+    );
+
+    return res;
+}
+
+///
+/// \brief Get the size and modification time of a file on the host
+///
+/// Unlike \c s2e_stat, this does not ask the plugin to hash the file contents, so the cost does not depend on the
+/// size of the file. Plugins that do not support \c S2E_HOSTFILES_STAT_NO_DIGEST still compute the digest.
+///
+/// \param[in] fname Path to the host file. This path must be relative to the \c HostFiles plugin base directory
+/// \param[out] st Receives the file information, without a valid digest
+/// \return 0 on success, -1 on error
+///
+static inline int s2e_stat_metadata(const char *fname, struct S2E_HOSTFILES_STAT *st) {
+    st->size = 0;
+    st->mtime = 0;
+    st->crc32c = 0;
+    st->flags = S2E_HOSTFILES_STAT_NO_DIGEST;
+    return s2e_stat(fname, st);
+}
+
+struct S2E_HOSTFILES_RENAME {
+    // Pointers to the current and new names of the file
+    uint64_t from;
+    uint64_t to;
+} __attribute__((packed));
+
+///
+/// \brief Rename a file that was created with \c s2e_create
+///
+/// Requires that the \c HostFiles plugin is enabled. The rename fails if a file with the new name already exists,
+/// so that the files uploaded by other states are never replaced.
+///
+/// \param[in] from Current name of the file
+/// \param[in] to New name of the file
+/// \return 0 on success, -1 on error
+///
+static inline int s2e_rename(const char *from, const char *to) {
+    struct S2E_HOSTFILES_RENAME req;
+    int res;
+
+    req.from = (uintptr_t) from;
+    req.to = (uintptr_t) to;
+
+    __s2e_touch_string(from);
+    __s2e_touch_string(to);
+    __asm__ __volatile__(
+        S2E_INSTRUCTION_COMPLEX(HOST_FILES_OPCODE, HOST_FILES_RENAME_OPCODE)
+        : "=a" (res) : "a" (-1), "c" (&req) : "memory"
+    );
+
+    return res;
+}
+
+///
+/// \brief Type of a directory entry returned by \c s2e_listdir
+///
+enum S2E_HOSTFILES_DIRENT_TYPE {
+    S2E_HOSTFILES_DT_FILE = 0,
+    S2E_HOSTFILES_DT_DIR = 1,
+    S2E_HOSTFILES_DT_OTHER = 2,
+};
+
+struct S2E_HOSTFILES_LISTDIR {
+    // Pointer to the directory path
+    uint64_t path;
+
+    // Pointer to the buffer that receives the entries
+    uint64_t buffer;
+    uint64_t size;
+
+    // Index of the first entry to return. Updated with the index of the entry that follows the returned ones.
+    uint64_t cookie;
+} __attribute__((packed));
+
+///
+/// \brief List the contents of a directory on the host
+///
+/// Requires that the \c HostFiles plugin is enabled.
+///
+/// The buffer is filled with as many entries as fit in it. Each entry consists of one byte that holds an
+/// \c S2E_HOSTFILES_DIRENT_TYPE, followed by the null-terminated entry name. The "." and ".." entries are not
+/// returned. Set \c cookie to 0 before the first call and keep calling the function until it returns 0 in order
+/// to get all the entries of large directories.
+///
+/// \param[in] dirname Path to the host directory. This path must be relative to the \c HostFiles plugin base directory
+/// \param[out] buf Buffer to store the entries into
+/// \param[in] size Size of the buffer
+/// \param[in,out] cookie Position of the listing
+/// \return The number of entries stored in the buffer, 0 if there are no more entries, -1 on error.
+/// All the returned entries, including their null terminator, lie within the first \c size bytes of the buffer.
+/// Callers should nevertheless not read past the end of the buffer when parsing it.
+///
+static inline int s2e_listdir(const char *dirname, char *buf, int size, uint64_t *cookie) {
+    struct S2E_HOSTFILES_LISTDIR req;
+    int res;
+
+    req.path = (uintptr_t) dirname;
+    req.buffer = (uintptr_t) buf;
+    req.size = size;
+    req.cookie = *cookie;
+
+    __s2e_touch_string(dirname);
+    __s2e_touch_buffer(buf, size);
+    __asm__ __volatile__(
+        S2E_INSTRUCTION_COMPLEX(HOST_FILES_OPCODE, HOST_FILES_LISTDIR_OPCODE)
+        : "=a" (res) : "a" (-1), "c" (&req) : "memory"
+    );
+
+    *cookie = req.cookie;
+    return res;
+}
+
 ///
 /// \brief Terminate the currently-executing state if \c b is zero
 ///
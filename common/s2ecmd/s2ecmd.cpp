@@ -32,19 +32,30 @@
 #include <s2e/seed_searcher.h>
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#ifdef _WIN32
-#include <windows.h>
-#define SLEEP(x) Sleep((x) *1000)
-#else
-#define SLEEP(x) sleep(x)
+#ifndef _WIN32
+#include <signal.h>
+#include <stdio_ext.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "serve.h"
 #endif
 
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
 typedef int (*cmd_handler_t)(int argc, const char **args);
 
 typedef struct _cmd_t {
@@ -99,62 +110,134 @@ static int handler_check(int argc, const char **args) {
 }
 
 static int handler_wait(int argc, const char **args) {
+    int timeout_ms = -1;
+    if (argc > 0) {
+        char *end;
+        long seconds = strtol(args[0], &end, 0);
+        if (*args[0] == 0 || *end || seconds < 0 || seconds > INT_MAX / 1000) {
+            fprintf(stderr, "Invalid timeout %s\n", args[0]);
+            return -1;
+        }
+        timeout_ms = seconds * 1000;
+    }
+
     s2e_message("Waiting for S2E...");
-    while (!s2e_check()) {
-        SLEEP(1);
+    if (!s2e_wait_for_mode(timeout_ms)) {
+        fprintf(stderr, "Timed out waiting for S2E mode\n");
+        return 1;
     }
     s2e_message("Done waiting for S2E.");
     return 0;
 }
 
-static int handler_symbwrite(int argc, const char **args) {
-    int n_bytes = -1;
-    int i;
+// Size of the chunks written by symbwrite, each of which is a separate symbolic variable
+#define SYMBWRITE_CHUNK_SIZE (64 * 1024)
 
-    n_bytes = atoi(args[0]);
-    if (n_bytes < 0) {
+static int parse_byte_count(const char *arg, uint64_t *count) {
+    char *end = nullptr;
+    while (isspace((unsigned char) *arg)) {
+        ++arg;
+    }
+
+    if (*arg == '-') {
         fprintf(stderr, "number of bytes may not be negative\n");
         return -1;
-    } else if (n_bytes == 0) {
-        return -2;
     }
 
-    char *buffer = (char *) calloc(1, n_bytes + 1);
-    s2e_make_symbolic(buffer, n_bytes, "buffer");
-
-    for (i = 0; i < n_bytes; ++i) {
-        putchar(buffer[i]);
+    *count = strtoull(arg, &end, 0);
+    if (end == arg || *end) {
+        fprintf(stderr, "invalid number of bytes: %s\n", arg);
+        return -1;
     }
 
-    free(buffer);
-
     return 0;
 }
 
-static int handler_symbwrite_dec(int argc, const char **args) {
-    int n_bytes = -1;
-    int i;
+static int write_all(int fd, const char *buf, size_t size) {
+    while (size > 0) {
+        ssize_t ret = write(fd, buf, size);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret <= 0) {
+            fprintf(stderr, "could not write to stdout\n");
+            return -1;
+        }
 
-    n_bytes = atoi(args[0]);
-    if (n_bytes < 0) {
-        fprintf(stderr, "number of bytes may not be negative\n");
-        return -1;
-    } else if (n_bytes == 0) {
+        buf += ret;
+        size -= ret;
+    }
+
+    return 0;
+}
+
+///
+/// \brief Write symbolic bytes to stdout
+///
+/// The bytes are produced in chunks of SYMBWRITE_CHUNK_SIZE bytes that reuse the same buffer, so memory usage does not
+/// depend on the number of bytes. Each chunk is a separate symbolic variable, named buffer_N after its index, or
+/// buffer if there is only one chunk.
+///
+/// \param count the number of bytes
+/// \param digits whether to constrain the bytes to decimal digits
+/// \return 0 on success, -1 on failure
+///
+static int write_symbolic(uint64_t count, bool digits) {
+    size_t size = count < SYMBWRITE_CHUNK_SIZE ? count : SYMBWRITE_CHUNK_SIZE;
+    char *buffer = (char *) malloc(size);
+    if (!buffer) {
+        fprintf(stderr, "could not allocate %zu bytes\n", size);
         return -1;
     }
 
-    char *buffer = (char *) calloc(1, n_bytes + 1);
-    memset(buffer, '0', n_bytes);
-    s2e_make_symbolic(buffer, n_bytes, "buffer");
+    // Keep the output in order with what was printed through stdio
+    fflush(stdout);
+
+    int ret = 0;
+    for (uint64_t offset = 0, index = 0; offset < count && !ret; offset += size, ++index) {
+        size = count - offset < SYMBWRITE_CHUNK_SIZE ? count - offset : SYMBWRITE_CHUNK_SIZE;
+
+        char name[32];
+        if (count <= SYMBWRITE_CHUNK_SIZE) {
+            snprintf(name, sizeof(name), "buffer");
+        } else {
+            snprintf(name, sizeof(name), "buffer_%" PRIu64, index);
+        }
 
-    for (i = 0; i < n_bytes; ++i) {
-        s2e_assume_range(buffer[i], '0', '9');
-        putchar(buffer[i]);
+        // The concrete values of the symbolic bytes, which must not depend on the previous chunk or on the heap
+        memset(buffer, digits ? '0' : 0, size);
+        s2e_make_symbolic(buffer, size, name);
+
+        if (digits) {
+            s2e_assume_range_buffer(buffer, size, '0', '9');
+        }
+
+        ret = write_all(STDOUT_FILENO, buffer, size);
     }
 
     free(buffer);
+    return ret;
+}
 
-    return 0;
+static int handler_symbwrite(int argc, const char **args) {
+    uint64_t n_bytes;
+    if (parse_byte_count(args[0], &n_bytes) < 0) {
+        return -1;
+    } else if (n_bytes == 0) {
+        return -2;
+    }
+
+    return write_symbolic(n_bytes, false);
+}
+
+static int handler_symbwrite_dec(int argc, const char **args) {
+    uint64_t n_bytes;
+    if (parse_byte_count(args[0], &n_bytes) < 0) {
+        return -1;
+    } else if (n_bytes == 0) {
+        return -1;
+    }
+
+    return write_symbolic(n_bytes, true);
 }
 
 static int handler_exemplify(int argc, const char **args) {
@@ -268,17 +351,361 @@ static int handler_flush_tbs(int argc, const char **args) {
     return 0;
 }
 
+static int run_command(int argc, const char **argv);
+
+///
+/// \brief Split a line of a batch file into words
+///
+/// Words are separated by blanks. Single quotes keep their contents verbatim, double quotes and backslashes work as
+/// in the shell. $? outside of single quotes is replaced with the status of the previous command. A word that starts
+/// with # starts a comment.
+///
+/// \return 0 on success, -1 if a quote is not closed
+///
+static int split_line(const std::string &line, int status, std::vector<std::string> &words) {
+    std::string word;
+    bool in_word = false;
+    char quote = 0;
+
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        char next = i + 1 < line.size() ? line[i + 1] : 0;
+
+        if (quote == '\'') {
+            if (c == '\'') {
+                quote = 0;
+            } else {
+                word += c;
+            }
+        } else if (c == '\\' && next && (!quote || next == '"' || next == '\\' || next == '$')) {
+            word += next;
+            in_word = true;
+            ++i;
+        } else if (quote == '"' && c == '"') {
+            quote = 0;
+        } else if (!quote && (c == '\'' || c == '"')) {
+            quote = c;
+            in_word = true;
+        } else if (c == '$' && next == '?') {
+            word += std::to_string(status);
+            in_word = true;
+            ++i;
+        } else if (!quote && isspace((unsigned char) c)) {
+            if (in_word) {
+                words.push_back(word);
+                word.clear();
+                in_word = false;
+            }
+        } else if (!quote && !in_word && c == '#') {
+            break;
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+
+    if (quote) {
+        return -1;
+    }
+
+    if (in_word) {
+        words.push_back(word);
+    }
+
+    return 0;
+}
+
+///
+/// \brief Run the commands of a file, one per line, in this process
+///
+/// This avoids starting s2ecmd for each command of a script. With -e, execution stops at the first command that
+/// fails. Commands that read stdin should not be used when the commands themselves are read from stdin.
+///
+/// \return the status of the last command that was run
+///
+static int handler_batch(int argc, const char **args) {
+    bool stop_on_error = argc > 0 && !strcmp(args[0], "-e");
+    if (stop_on_error) {
+        --argc;
+        ++args;
+    }
+
+    if (argc > 1) {
+        fprintf(stderr, "Usage: batch [-e] [FILE|-]\n");
+        return -1;
+    }
+
+    const char *file = argc ? args[0] : "-";
+    std::ifstream in_file;
+    std::istream *in = &std::cin;
+    if (strcmp(file, "-")) {
+        in_file.open(file);
+        if (!in_file) {
+            fprintf(stderr, "Could not open %s\n", file);
+            return -1;
+        }
+        in = &in_file;
+    }
+
+    int status = 0;
+    unsigned line_number = 0;
+    std::string line;
+
+    while (std::getline(*in, line)) {
+        ++line_number;
+
+        std::vector<std::string> words;
+        if (split_line(line, status, words) < 0) {
+            fprintf(stderr, "%s:%u: unterminated quote\n", file, line_number);
+            status = 1;
+        } else if (words.empty()) {
+            continue;
+        } else {
+            std::vector<const char *> argv;
+            for (const auto &word : words) {
+                argv.push_back(word.c_str());
+            }
+
+            // Same status as if the command had been run on its own
+            status = run_command(argv.size(), argv.data());
+            if (status < 0) {
+                status = -status;
+            }
+        }
+
+        if (status && stop_on_error) {
+            fprintf(stderr, "%s:%u: stopping after a command failed with status %d\n", file, line_number, status);
+            break;
+        }
+    }
+
+    return status;
+}
+
 #define COMMAND(c, arg_count, desc) \
     { #c, handler_##c, arg_count, arg_count, desc }
 
 #define COMMAND2(c, min_arg_count, max_arg_count, desc) \
     { #c, handler_##c, min_arg_count, max_arg_count, desc }
 
+#ifndef _WIN32
+///
+/// \brief Run a command with the standard streams and current directory of a client
+///
+static int run_client_command(std::vector<const char *> &argv, const int *fds) {
+    fflush(stdout);
+    fflush(stderr);
+
+    int saved[3];
+    for (int i = 0; i < 3; ++i) {
+        saved[i] = dup(i);
+        dup2(fds[i], i);
+    }
+
+    int saved_cwd = open(".", O_RDONLY | O_DIRECTORY);
+    if (fchdir(fds[3]) < 0) {
+        fprintf(stderr, "Could not change to the directory of the client\n");
+    }
+
+    int status = run_command(argv.size(), argv.data());
+
+    fflush(stdout);
+    fflush(stderr);
+
+    // Drop what was buffered from the stdin of the client, and the end of file state that batch left in std::cin
+    __fpurge(stdin);
+    clearerr(stdin);
+    std::cin.clear();
+    std::cin.sync();
+
+    for (int i = 0; i < 3; ++i) {
+        dup2(saved[i], i);
+        close(saved[i]);
+    }
+
+    if (saved_cwd >= 0) {
+        if (fchdir(saved_cwd) < 0) {
+            fprintf(stderr, "Could not restore the directory of the daemon\n");
+        }
+        close(saved_cwd);
+    }
+
+    return status;
+}
+
+///
+/// \brief Receive a request from a client, run it and send back its status
+///
+/// \return 0 if a request was served, -1 once the client has disconnected
+///
+static int serve_request(int conn) {
+    static char buf[S2ECMD_REQUEST_MAX + 1];
+
+    union {
+        struct cmsghdr hdr;
+        char data[CMSG_SPACE(S2ECMD_REQUEST_FDS * sizeof(int))];
+    } control;
+
+    struct iovec iov = {buf, S2ECMD_REQUEST_MAX};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    ssize_t len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    if (len <= 0) {
+        return -1;
+    }
+
+    std::vector<int> fds;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+                fds.push_back(fd);
+            }
+        }
+    }
+
+    std::vector<const char *> argv;
+    buf[len] = 0;
+    for (char *word = buf; word < buf + len; word += strlen(word) + 1) {
+        argv.push_back(word);
+    }
+
+    int32_t status = -1;
+    if (fds.size() != S2ECMD_REQUEST_FDS || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || argv.empty()) {
+        // Malformed request, there is nowhere to report it but the status
+    } else if (!strcmp(argv[0], "serve")) {
+        dprintf(fds[2], "serve cannot be run by the daemon\n");
+    } else {
+        status = run_client_command(argv, fds.data());
+    }
+
+    for (int fd : fds) {
+        close(fd);
+    }
+
+    // Same status as if the command had been run on its own
+    if (status < 0) {
+        status = -status;
+    }
+
+    if (send(conn, &status, sizeof(status), MSG_NOSIGNAL) != sizeof(status)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+///
+/// \brief Start a daemon that runs the commands sent by s2ecmdc
+///
+/// The daemon is part of the guest, so it is forked along with the S2E state and every state has its own copy.
+/// Commands are run one at a time in the order in which they arrive, and a client waits for the status of its command
+/// before going on. A state that forks or is killed while running a command therefore sees the same sequence of
+/// commands as it would with separate s2ecmd processes. Commands run with the environment of the daemon, but with the
+/// standard streams and the current directory of the client.
+///
+/// Only the user that started the daemon may connect to the socket. An existing socket at the same path is replaced,
+/// but any other kind of file is left alone.
+///
+/// The parent returns once the socket accepts connections, so that clients can be started right away.
+///
+static int handler_serve(int argc, const char **args) {
+    const char *path = argc ? args[0] : getenv("S2ECMD_SOCKET");
+    if (!path || !*path) {
+        path = S2ECMD_SOCKET_PATH;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        fprintf(stderr, "Could not create socket\n");
+        return -1;
+    }
+
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket\n", path);
+            close(sock);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    // Create the socket with mode 0600
+    mode_t mask = umask(0077);
+    int ret = bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+    umask(mask);
+
+    if (ret < 0 || listen(sock, 16) < 0) {
+        fprintf(stderr, "Could not listen on %s\n", path);
+        close(sock);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Could not start the daemon\n");
+        close(sock);
+        return -1;
+    } else if (pid > 0) {
+        printf("s2ecmd daemon %d is listening on %s\n", (int) pid, path);
+        close(sock);
+        return 0;
+    }
+
+    setsid();
+    signal(SIGPIPE, SIG_IGN);
+
+    // The output of the commands goes to the clients
+    int null_fd = open("/dev/null", O_RDWR);
+    for (int i = 0; i < 3 && null_fd >= 0; ++i) {
+        dup2(null_fd, i);
+    }
+    if (null_fd > 2) {
+        close(null_fd);
+    }
+
+    while (1) {
+        int conn = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+
+        while (serve_request(conn) == 0) {
+        }
+
+        close(conn);
+    }
+
+    close(sock);
+    return -1;
+}
+#endif
+
 static cmd_t s_commands[] = {
     COMMAND(kill, 2, "Kill the current state with the specified numeric status and message"),
     COMMAND(message, 1, "Display a message"),
     COMMAND(check, 0, "Check if we are in S2E mode"),
-    COMMAND(wait, 0, "Wait for S2E mode"),
+    COMMAND2(wait, 0, 1, "Wait for S2E mode, at most the given number of seconds if specified"),
     COMMAND(yield, 0, "Yield the current state"),
     COMMAND(symbwrite, 1, "Write n symbolic bytes to stdout"),
     COMMAND(symbwrite_dec, 1, "Write n symbolic decimal digits to stdout"),
@@ -294,6 +721,12 @@ static cmd_t s_commands[] = {
     COMMAND(get_seed_file, 0, "Returns the name of the currently available seed file"),
     COMMAND(seedsearcher_enable, 0, "Activates the seed searcher"),
     COMMAND(flush_tbs, 0, "Flush the translation block cache"),
+#ifndef _WIN32
+    COMMAND2(serve, 0, 1, "Start a daemon that runs the commands of s2ecmdc clients. The socket defaults to "
+                          "$S2ECMD_SOCKET or " S2ECMD_SOCKET_PATH),
+#endif
+    COMMAND2(batch, 0, 2, "Run the commands read from the given file or stdin, one per line. $? is replaced by the "
+                          "status of the previous command. With -e, stop at the first command that fails"),
     {nullptr, nullptr, 0, 0, nullptr}};
 
 static void print_commands(void) {
@@ -317,40 +750,46 @@ static int find_command(const char *cmd) {
     return -1;
 }
 
-int main(int argc, const char **argv) {
-    const char *cmd = nullptr;
-    int cmd_index = 0;
-    int retval = -1;
-
-    unsigned min_args, max_args;
-
-    if (argc < 2) {
-        print_commands();
-        goto err;
-    }
-
-    cmd = argv[1];
-    cmd_index = find_command(cmd);
+///
+/// \brief Run a command of s_commands
+///
+/// \param argc the number of words, including the command name
+/// \param argv the command name followed by its arguments
+/// \return the status of the command, or -1 if it could not be run
+///
+static int run_command(int argc, const char **argv) {
+    const char *cmd = argv[0];
+    int cmd_index = find_command(cmd);
 
     if (cmd_index == -1) {
         fprintf(stderr, "Command %s not found\n", cmd);
-        goto err;
+        return -1;
     }
 
-    argc -= 2;
-    ++argv;
+    --argc;
     ++argv;
 
-    min_args = s_commands[cmd_index].min_args_count;
-    max_args = s_commands[cmd_index].max_args_count;
+    unsigned min_args = s_commands[cmd_index].min_args_count;
+    unsigned max_args = s_commands[cmd_index].max_args_count;
 
     if (!((unsigned) argc >= min_args && (unsigned) argc <= max_args)) {
         fprintf(stderr, "Invalid number of arguments supplied (received %d, expected %d)\n", argc,
                 s_commands[cmd_index].min_args_count);
+        return -1;
+    }
+
+    return s_commands[cmd_index].handler(argc, argv);
+}
+
+int main(int argc, const char **argv) {
+    int retval = -1;
+
+    if (argc < 2) {
+        print_commands();
         goto err;
     }
 
-    retval = s_commands[cmd_index].handler(argc, argv);
+    retval = run_command(argc - 1, argv + 1);
 
 err:
     // On Windows msys bash, a negative value returned from main will appear as 0.
@@ -0,0 +1,151 @@
+/*
+ * S2E Selective Symbolic Execution Platform
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+///
+/// s2ecmdc forwards its arguments to a daemon started with s2ecmd serve and exits with the status of the command.
+/// This costs a socket round trip instead of starting s2ecmd, which matters in scripts that call it many times. If no
+/// daemon is listening, s2ecmdc runs s2ecmd instead, so it can always replace it.
+///
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+static void exec_s2ecmd(char **argv) {
+    // Look for s2ecmd next to the client, then in the PATH
+    const char *slash = strrchr(argv[0], '/');
+    if (slash) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%.*s/s2ecmd", (int) (slash - argv[0]), argv[0]);
+        argv[0] = path;
+        execv(path, argv);
+    }
+
+    argv[0] = "s2ecmd";
+    execvp("s2ecmd", argv);
+
+    fprintf(stderr, "Could not run s2ecmd\n");
+    exit(1);
+}
+
+static int connect_daemon(void) {
+    const char *path = getenv("S2ECMD_SOCKET");
+    if (!path || !*path) {
+        path = S2ECMD_SOCKET_PATH;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+int main(int argc, char **argv) {
+    static char payload[S2ECMD_REQUEST_MAX];
+    size_t len = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        size_t size = strlen(argv[i]) + 1;
+        if (len + size > sizeof(payload)) {
+            exec_s2ecmd(argv);
+        }
+        memcpy(payload + len, argv[i], size);
+        len += size;
+    }
+
+    // Without arguments, s2ecmd prints the list of commands
+    int sock = argc > 1 ? connect_daemon() : -1;
+    if (sock < 0) {
+        exec_s2ecmd(argv);
+    }
+
+    // The daemon needs valid descriptors, even if some standard streams are closed
+    int fds[S2ECMD_REQUEST_FDS];
+    for (int i = 0; i < 3; ++i) {
+        fds[i] = fcntl(i, F_GETFD) < 0 ? open("/dev/null", O_RDWR) : i;
+    }
+    fds[3] = open(".", O_RDONLY | O_DIRECTORY);
+    if (fds[3] < 0) {
+        fds[3] = open("/", O_RDONLY | O_DIRECTORY);
+    }
+
+    union {
+        struct cmsghdr hdr;
+        char data[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = {payload, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    int32_t status;
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t) len ||
+        recv(sock, &status, sizeof(status), 0) != sizeof(status)) {
+        fprintf(stderr, "Lost the connection to the s2ecmd daemon\n");
+        return 1;
+    }
+
+    return status;
+}
@@ -52,6 +52,12 @@ struct offset_size_t {
 typedef std::vector<offset_size_t> symbolic_locs_t;
 typedef std::vector<bool> bitmap_t;
 
+// Bounds of the symbolic bytes, inclusive
+struct byte_range_t {
+    uint8_t lower;
+    uint8_t upper;
+};
+
 // trim from start (in place)
 static inline void ltrim(std::string &s) {
     s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int ch) { return !std::isspace(ch); }));
@@ -160,6 +166,40 @@ static bool get_bitmap(const symbolic_locs_t &locs, unsigned input_size, bitmap_
     return true;
 }
 
+///
+/// \brief Decode a byte range from the given string.
+///
+/// The string must have the format L-U, where L and U are the inclusive
+/// bounds of the bytes, as decimal or hexadecimal numbers. For example,
+/// "0x30-0x39" restricts the bytes to decimal digits.
+///
+/// \param input the byte range string
+/// \param out the decoded range
+/// \return true if success, false if the input string is invalid
+///
+static bool parse_byte_range(const char *input, byte_range_t &out) {
+    char *end = nullptr;
+
+    unsigned long lower = strtoul(input, &end, 0);
+    if (end == input || *end != '-') {
+        return false;
+    }
+
+    input = end + 1;
+    unsigned long upper = strtoul(input, &end, 0);
+    if (end == input || *end) {
+        return false;
+    }
+
+    if (lower > upper || upper > 0xff) {
+        return false;
+    }
+
+    out.lower = lower;
+    out.upper = upper;
+    return true;
+}
+
 ///
 /// \brief replace special characters in the filename with underscores.
 ///
@@ -207,10 +247,11 @@ static std::string get_chunk_name(const std::string &cleaned_name, unsigned curr
 /// \param buffer the pointer where to store the original concrete data
 /// \param buffer_size the size of the buffer in bytes
 /// \param variable_name the name of the variable that encodes the chunk information
+/// \param range the bounds of the symbolic bytes, or nullptr if they are unconstrained
 /// \return the number of bytes read/written to the file
 ///
 static ssize_t make_chunk_symbolic(int fd, off_t offset, void *buffer, unsigned buffer_size,
-                                   const std::string &variable_name) {
+                                   const std::string &variable_name, const byte_range_t *range) {
     // Read the file in chunks and make them symbolic
     if (lseek(fd, offset, SEEK_SET) < 0) {
         s2e_kill_state_printf(-1, "symbfile: could not seek to position %d", offset);
@@ -226,6 +267,9 @@ static ssize_t make_chunk_symbolic(int fd, off_t offset, void *buffer, unsigned
 
     // Make the buffer symbolic
     s2e_make_symbolic(buffer, read_count, variable_name.c_str());
+    if (range) {
+        s2e_assume_range_buffer(buffer, read_count, range->lower, range->upper);
+    }
 
     // Write it back
     if (lseek(fd, offset, SEEK_SET) < 0) {
@@ -314,9 +358,11 @@ err:
 /// \param fd the descriptor of the file to be made symbolic (must be on a ram disk)
 /// \param cleaned_name the sanitized name of the file
 /// \param bitmap the parts of the file to be made symbolic
+/// \param range the bounds of the symbolic bytes, or nullptr if they are unconstrained
 /// \return error code, 0 on success
 ///
-static int make_partial_file_symbolic(int fd, const std::string &cleaned_name, const bitmap_t &bitmap) {
+static int make_partial_file_symbolic(int fd, const std::string &cleaned_name, const bitmap_t &bitmap,
+                                      const byte_range_t *range) {
     for (unsigned i = 0; i < bitmap.size(); ++i) {
         if (!bitmap[i]) {
             continue;
@@ -324,7 +370,7 @@ static int make_partial_file_symbolic(int fd, const std::string &cleaned_name, c
 
         uint8_t buffer;
         std::string name = get_chunk_name(cleaned_name, i, bitmap.size());
-        auto ret = make_chunk_symbolic(fd, i, &buffer, sizeof(buffer), name);
+        auto ret = make_chunk_symbolic(fd, i, &buffer, sizeof(buffer), name, range);
         if (ret < 0) {
             return ret;
         }
@@ -340,9 +386,11 @@ static int make_partial_file_symbolic(int fd, const std::string &cleaned_name, c
 /// \param file_size the size in bytes of the file
 /// \param block_size the size of a chunk (or symbolic variable)
 /// \param cleaned_name the sanitized name of the file
+/// \param range the bounds of the symbolic bytes, or nullptr if they are unconstrained
 /// \return error code (0 on success)
 ///
-static int make_whole_file_symbolic(int fd, unsigned file_size, unsigned block_size, const std::string &cleaned_name) {
+static int make_whole_file_symbolic(int fd, unsigned file_size, unsigned block_size, const std::string &cleaned_name,
+                                    const byte_range_t *range) {
     char buffer[block_size];
 
     unsigned current_chunk = 0;
@@ -356,7 +404,7 @@ static int make_whole_file_symbolic(int fd, unsigned file_size, unsigned block_s
         ssize_t totransfer = file_size > sizeof(buffer) ? sizeof(buffer) : file_size;
 
         std::string name = get_chunk_name(cleaned_name, current_chunk, total_chunks);
-        auto read_count = make_chunk_symbolic(fd, offset, buffer, totransfer, name);
+        auto read_count = make_chunk_symbolic(fd, offset, buffer, totransfer, name, range);
 
         offset += read_count;
         file_size -= read_count;
@@ -386,6 +434,10 @@ static int make_whole_file_symbolic(int fd, unsigned file_size, unsigned block_s
 /// The chunk_size is ignored when S2E_SYMFILE_RANGES is present (in which case chunk size
 /// is set to 1).
 ///
+/// S2E_SYMFILE_BYTE_RANGE is an optional environment variable that restricts
+/// every symbolic byte to the given inclusive range, e.g., "0x30-0x39" for
+/// decimal digits. The concrete bytes of the file must be in that range.
+///
 /// The path to the file must be located on a RAM disk, otherwise it will not
 /// be possible to make it symbolic. This commands overwrites the original file
 /// with symbolic data. That data will be immediately concretized by S2E if the file
@@ -427,6 +479,18 @@ int handler_symbfile(int argc, const char **args) {
         }
     }
 
+    byte_range_t byte_range;
+    const byte_range_t *range = nullptr;
+
+    const char *byte_range_env = getenv("S2E_SYMFILE_BYTE_RANGE");
+    if (byte_range_env) {
+        if (!parse_byte_range(byte_range_env, byte_range)) {
+            s2e_kill_state_printf(0, "Invalid S2E_SYMFILE_BYTE_RANGE variable: %s", byte_range_env);
+            return -1;
+        }
+        range = &byte_range;
+    }
+
     unsigned block_size = 0x1000;
 
     if (argc == 2) {
@@ -460,9 +524,9 @@ int handler_symbfile(int argc, const char **args) {
             s2e_kill_state_printf(-1, "Symbolic ranges exceed the size of the concrete file");
             return -3;
         }
-        ret = make_partial_file_symbolic(fd, cleaned_name, sym_bitmap);
+        ret = make_partial_file_symbolic(fd, cleaned_name, sym_bitmap, range);
     } else {
-        ret = make_whole_file_symbolic(fd, size, block_size, cleaned_name);
+        ret = make_whole_file_symbolic(fd, size, block_size, cleaned_name, range);
     }
 
     close(fd);
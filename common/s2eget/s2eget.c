@@ -27,6 +27,11 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <ctype.h>
+#include <inttypes.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,14 +41,83 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <s2e/hostfiles.h>
 #include <s2e/s2e.h>
 
 #define BUFFER_SIZE 1024 * 64
 
+// Size of the destination file region that is mapped at once when reading directly into the page cache.
+// Mapping the file in windows keeps the address space usage bounded on 32-bit guests.
+#define MAP_WINDOW_SIZE 1024 * 1024 * 16
+
+// Files smaller than this are transferred with a single stream unless the number of streams is set explicitly
+#define PARALLEL_MIN_SIZE 1024 * 1024 * 64
+#define MAX_STREAMS 16
+
+// Limits of the chunk size that can be set on the command line
+#define MIN_CHUNK_SIZE 512
+#define MAX_CHUNK_SIZE 1024 * 1024 * 64
+
 const char *g_host_file = NULL;
 const char *g_dest_file = NULL;
+const char *g_manifest = NULL;
+int g_recursive = 0;
+int g_use_mmap = 1;
+int g_resume = 0;
+uint64_t g_offset = 0;
+uint64_t g_length = UINT64_MAX;
+unsigned g_streams = 0;
+int g_raw = 0;
+int g_sparse = 0;
+const char *g_cache_dir = NULL;
+
+// Chunk size bounds set on the command line, 0 for the defaults
+unsigned g_chunk_size = 0;
+unsigned g_min_chunk_size = 0;
+unsigned g_max_chunk_size = 0;
+
+// Picks the size of the chunks of raw transfers. It is shared by all the files of a manifest.
+struct s2e_chunk_tuner_t g_tuner;
+
+// Progress messages go to stderr when the file contents are written to stdout
+FILE *g_info = NULL;
+
+static double get_time(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void update_chunk_size(unsigned count) {
+    if (s2e_chunk_tuner_update(&g_tuner, count)) {
+        fprintf(g_info, "... chunk size settled at %u bytes (%.2f MiB/s)\n", g_tuner.size,
+                g_tuner.best_rate / (1024 * 1024));
+    }
+}
 
 static char *get_dest_file(const char *dest_file, const char *host_file) {
     char *path = NULL;
@@ -95,92 +169,1206 @@ end:
     return path;
 }
 
+static char *join_path(const char *dir, const char *name) {
+    unsigned max_len = strlen(dir) + strlen(name) + 1 + 1;
+    char *path = calloc(max_len, sizeof(char));
+    if (!path) {
+        fprintf(stderr, "Could not allocate memory for the file path\n");
+        return NULL;
+    }
+
+    snprintf(path, max_len, "%s/%s", dir, name);
+    return path;
+}
+
+///
+/// \brief Write the whole buffer, retrying after partial writes and interruptions
+///
+/// \return 0 on success, -1 on failure
+///
+static int write_all(int fd, const char *buf, unsigned count) {
+    while (count > 0) {
+        int ret = write(fd, buf, count);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EPIPE) {
+                fprintf(stderr, "The reader closed the output\n");
+            } else {
+                fprintf(stderr, "Could not write to file\n");
+            }
+            return -1;
+        }
+
+        buf += ret;
+        count -= ret;
+    }
+
+    return 0;
+}
+
+static int is_zero(const char *buf, unsigned count) {
+    // Comparing the buffer with itself shifted by one byte uses the vectorized memcmp of the C library
+    return count > 0 && buf[0] == 0 && !memcmp(buf, buf + 1, count - 1);
+}
+
+///
+/// \brief Write a chunk to the destination file, or skip it if it only contains zeros and holes are allowed
+///
+/// Skipped chunks become holes once the file is extended past them, either by a later write or by finish_sparse.
+///
+/// \param fd the destination file descriptor
+/// \param buf the chunk
+/// \param count the size of the chunk
+/// \param holes NULL to always write the chunk, otherwise incremented with the number of bytes skipped
+/// \return 0 on success, -1 on failure
+///
+static int write_data(int fd, const char *buf, unsigned count, uint64_t *holes) {
+    if (holes && is_zero(buf, count)) {
+        if (lseek(fd, count, SEEK_CUR) < 0) {
+            fprintf(stderr, "Could not seek in destination file\n");
+            return -1;
+        }
+
+        *holes += count;
+        return 0;
+    }
+
+    return write_all(fd, buf, count);
+}
+
+///
+/// \brief Set the size of a file written with write_data to the current position, in case it ends with a hole
+///
+static int finish_sparse(int fd) {
+    off_t end = lseek(fd, 0, SEEK_CUR);
+    if (end < 0 || ftruncate(fd, end) < 0) {
+        fprintf(stderr, "Could not set the size of the destination file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+///
+/// \brief Copy the host file into the destination file through an intermediate buffer
+///
+/// \param in the host file
+/// \param fd the destination file descriptor, positioned where the data must be written
+/// \param length the maximum number of bytes to transfer
+/// \param fsize receives the number of transferred bytes
+/// \param holes NULL to write all the data, otherwise receives the number of zero bytes left as holes
+/// \return 0 on success, -1 on failure
+///
+static int copy_buffered(s2e_FILE *in, int fd, uint64_t length, uint64_t *fsize, uint64_t *holes) {
+    // The buffer is shared by all the files of a manifest, there is no need to allocate and clear it every time.
+    // It is large enough for any size the tuner may pick.
+    static char *buf = NULL;
+    if (!buf) {
+        if (!(buf = calloc(1, g_tuner.max))) {
+            fprintf(stderr, "Could not allocate transfer buffer\n");
+            return -1;
+        }
+
+        // The buffer is used for every chunk
+        s2e_make_resident(buf, g_tuner.max);
+    }
+
+    // Copy and write data from host to guest
+    while (*fsize < length) {
+        int count = g_tuner.size;
+        if (length - *fsize < count) {
+            count = length - *fsize;
+        }
+
+        int ret = s2e_fread(buf, 1, count, in);
+        if (s2e_ferror(in)) {
+            fprintf(stderr, "s2e_read failed\n");
+            return -1;
+        } else if (ret == 0) {
+            break;
+        }
+
+        if (write_data(fd, buf, ret, holes) < 0) {
+            return -1;
+        }
+
+        *fsize += ret;
+        update_chunk_size(ret);
+    }
+
+    return holes ? finish_sparse(fd) : 0;
+}
+
+#ifndef _WIN32
+///
+/// \brief Copy the host file by reading it directly into a shared mapping of the destination file
+///
+/// This avoids copying every chunk a second time from a bounce buffer with write(). The destination file is grown
+/// one window at a time and truncated to the end of the transferred data when done. This also happens on failure,
+/// so that an interrupted transfer can be resumed.
+///
+/// Each window is allocated with posix_fallocate before being mapped. Writing to a sparse mapping on a full file
+/// system raises SIGBUS instead of returning ENOSPC, which would kill the process and leave the padded file behind.
+///
+/// \param in the host file
+/// \param fd the destination file descriptor, opened for reading and writing
+/// \param pos the offset in the destination file where the data must be written
+/// \param length the maximum number of bytes to transfer
+/// \param fsize receives the number of transferred bytes
+/// \return 0 on success, 1 if the destination cannot be mapped and nothing was transferred yet, -1 on failure
+///
+static int copy_mmap(s2e_FILE *in, int fd, off_t pos, uint64_t length, uint64_t *fsize) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    int retval = -1;
+    int eof = 0;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return 1;
+    }
+
+    while (!eof && *fsize < length) {
+        // Mappings must start on a page boundary
+        off_t window_offset = pos & ~(off_t)(page_size - 1);
+        unsigned filled = pos - window_offset;
+
+        int err = posix_fallocate(fd, window_offset, MAP_WINDOW_SIZE);
+        if (err) {
+            if (*fsize == 0 && err != ENOSPC) {
+                retval = 1;
+            }
+            fprintf(stderr, "Could not allocate destination file: %s\n", strerror(err));
+            goto end;
+        }
+
+        char *map = mmap(NULL, MAP_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, window_offset);
+        if (map == MAP_FAILED) {
+            if (*fsize == 0) {
+                retval = 1;
+            }
+            fprintf(stderr, "Could not map destination file\n");
+            goto end;
+        }
+
+        while (filled < MAP_WINDOW_SIZE && *fsize < length) {
+            unsigned count = MAP_WINDOW_SIZE - filled;
+            if (count > g_tuner.size) {
+                count = g_tuner.size;
+            }
+            if (length - *fsize < count) {
+                count = length - *fsize;
+            }
+
+            // S2E writes guest memory without going through the page fault handler. Dirty each page of the chunk
+            // first, so that it is backed by a private, writable page cache page rather than a read-only mapping.
+            uintptr_t first_page = (uintptr_t)(map + filled) & ~(uintptr_t)(page_size - 1);
+            uintptr_t last_page = (uintptr_t)(map + filled + count - 1) & ~(uintptr_t)(page_size - 1);
+            for (uintptr_t page = first_page; page <= last_page; page += page_size) {
+                volatile char *p = (volatile char *) page;
+                *p = *p;
+            }
+
+            int ret = s2e_fread(map + filled, 1, count, in);
+            if (s2e_ferror(in)) {
+                fprintf(stderr, "s2e_read failed\n");
+                munmap(map, MAP_WINDOW_SIZE);
+                goto end;
+            } else if (ret == 0) {
+                eof = 1;
+                break;
+            }
+
+            filled += ret;
+            pos += ret;
+            *fsize += ret;
+            update_chunk_size(ret);
+        }
+
+        munmap(map, MAP_WINDOW_SIZE);
+    }
+
+    retval = 0;
+
+end:
+    // Also when falling back to another copy method, which must not find the file padded with zeros
+    if (ftruncate(fd, pos) < 0) {
+        fprintf(stderr, "Could not truncate destination file\n");
+        retval = -1;
+    }
+
+    return retval;
+}
+
+///
+/// \brief Describes the slice of the file that a transfer thread copies
+///
+struct stream_t {
+    const char *host_file;
+    int fd;
+    uint64_t host_offset;
+    off_t dest_offset;
+    uint64_t length;
+    unsigned chunk_size;
+    int sparse;
+    uint64_t transferred;
+    uint64_t holes;
+    int retval;
+};
+
+static void *stream_thread(void *opaque) {
+    struct stream_t *stream = opaque;
+    char *buf = NULL;
+
+    stream->retval = -1;
+
+    // The stream has its own buffer
+    s2e_FILE *in = s2e_fopen(stream->host_file, "r");
+    if (!in || s2e_setvbuf(in, 0) < 0) {
+        fprintf(stderr, "s2e_open of %s failed\n", stream->host_file);
+        if (in) {
+            s2e_fclose(in);
+        }
+        return NULL;
+    }
+
+    if (s2e_fseek(in, stream->host_offset, SEEK_SET) != (int64_t) stream->host_offset) {
+        fprintf(stderr, "Could not seek to offset %" PRIu64 " of %s\n", stream->host_offset, stream->host_file);
+        goto end;
+    }
+
+    buf = malloc(stream->chunk_size);
+    if (!buf) {
+        fprintf(stderr, "Could not allocate transfer buffer\n");
+        goto end;
+    }
+
+    while (stream->transferred < stream->length) {
+        int count = stream->chunk_size;
+        if (stream->length - stream->transferred < count) {
+            count = stream->length - stream->transferred;
+        }
+
+        int ret = s2e_fread(buf, 1, count, in);
+        if (ret <= 0) {
+            fprintf(stderr, "s2e_read failed\n");
+            goto end;
+        }
+
+        // The destination is already sized, skipping zero chunks leaves holes
+        if (stream->sparse && is_zero(buf, ret)) {
+            stream->holes += ret;
+        } else if (pwrite(stream->fd, buf, ret, stream->dest_offset + stream->transferred) != ret) {
+            fprintf(stderr, "Could not write to file\n");
+            goto end;
+        }
+
+        stream->transferred += ret;
+    }
+
+    stream->retval = 0;
+
+end:
+    free(buf);
+    s2e_fclose(in);
+    return NULL;
+}
+
+///
+/// \brief Copy a range of the host file using several host file descriptors in parallel
+///
+/// The destination file is sized up front and each thread writes a disjoint slice of it. On failure, the destination
+/// is truncated to the longest completed prefix of the range, so that the transfer can still be resumed from there.
+///
+/// \param host_file path of the host file
+/// \param fd the destination file descriptor
+/// \param pos the offset in the destination file where the data must be written
+/// \param offset the offset in the host file of the first byte to transfer
+/// \param length the number of bytes to transfer
+/// \param streams the number of threads to use
+/// \param fsize receives the number of transferred bytes
+/// \param holes NULL to write all the data, otherwise receives the number of zero bytes left as holes
+/// \return 0 on success, -1 on failure
+///
+static int copy_parallel(const char *host_file, int fd, off_t pos, uint64_t offset, uint64_t length,
+                         unsigned streams, uint64_t *fsize, uint64_t *holes) {
+    struct stream_t stream[MAX_STREAMS];
+    pthread_t threads[MAX_STREAMS];
+    unsigned started = 0;
+    int retval = 0;
+
+    if (ftruncate(fd, pos + length) < 0) {
+        fprintf(stderr, "Could not resize destination file\n");
+        return -1;
+    }
+
+    // Keep slices aligned to the transfer buffer size
+    uint64_t slice = (length / streams + BUFFER_SIZE - 1) / BUFFER_SIZE * BUFFER_SIZE;
+
+    for (unsigned i = 0; i < streams; ++i) {
+        uint64_t start = slice * i;
+        if (start >= length) {
+            break;
+        }
+
+        stream[i].host_file = host_file;
+        stream[i].fd = fd;
+        stream[i].host_offset = offset + start;
+        stream[i].dest_offset = pos + start;
+        stream[i].length = length - start < slice ? length - start : slice;
+        stream[i].chunk_size = g_tuner.size;
+        stream[i].sparse = holes != NULL;
+        stream[i].holes = 0;
+        stream[i].transferred = 0;
+        stream[i].retval = -1;
+
+        if (pthread_create(&threads[i], NULL, stream_thread, &stream[i])) {
+            fprintf(stderr, "Could not create transfer thread\n");
+            retval = -1;
+            break;
+        }
+
+        ++started;
+    }
+
+    // Slices are contiguous, the data is complete up to the first slice that was not entirely transferred
+    int complete = 1;
+    for (unsigned i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+        if (stream[i].retval < 0) {
+            retval = -1;
+        }
+
+        if (holes) {
+            *holes += stream[i].holes;
+        }
+
+        if (complete) {
+            *fsize += stream[i].transferred;
+            complete = stream[i].transferred == stream[i].length;
+        }
+    }
+
+    if (retval < 0 && ftruncate(fd, pos + *fsize) < 0) {
+        fprintf(stderr, "Could not truncate destination file\n");
+    }
+
+    return retval;
+}
+
+///
+/// \brief Determine how many streams to use to transfer the given range of a host file
+///
+/// Unless -j is given, parallel streams are only used when mmap is disabled, as the mmap path avoids the extra copy
+/// through a bounce buffer, and only on guests with several CPUs.
+///
+/// \param in the host file, positioned at \p offset when the function returns
+/// \param offset the offset of the first byte to transfer
+/// \param length the maximum number of bytes to transfer. Updated with the actual number of bytes left in the file
+/// when more than one stream is selected.
+/// \return the number of streams
+///
+static unsigned get_stream_count(s2e_FILE *in, uint64_t offset, uint64_t *length) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (g_streams == 1 || (!g_streams && ((g_use_mmap && !g_sparse) || cpus < 2))) {
+        return 1;
+    }
+
+    int64_t size = s2e_fseek(in, 0, SEEK_END);
+    if (s2e_fseek(in, offset, SEEK_SET) != (int64_t) offset || size < 0) {
+        // The HostFiles plugin does not support seeking, ranged reads are not possible
+        return 1;
+    }
+
+    uint64_t remaining = (uint64_t) size > offset ? size - offset : 0;
+    if (remaining > *length) {
+        remaining = *length;
+    }
+
+    unsigned streams = g_streams;
+    if (!streams) {
+        if (remaining < PARALLEL_MIN_SIZE) {
+            return 1;
+        }
+
+        streams = cpus > 4 ? 4 : cpus;
+    }
+
+    if (streams > 1) {
+        *length = remaining;
+    }
+
+    return streams;
+}
+#endif
+
+enum compression_t { COMPRESSION_NONE, COMPRESSION_GZIP, COMPRESSION_ZSTD };
+
+static const char *s_compression_suffix[] = {"", ".gz", ".zst"};
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+static int has_suffix(const char *str, const char *suffix) {
+    size_t len = strlen(str);
+    size_t suffix_len = strlen(suffix);
+    return len > suffix_len && !strcmp(str + len - suffix_len, suffix);
+}
+#endif
+
+///
+/// \brief Determine whether the given host file must be decompressed while it is transferred
+///
+/// Decompression is disabled for ranged and resumed transfers, which operate on the raw host file.
+///
+static enum compression_t get_compression(const char *host_file) {
+    if (g_raw || g_resume || g_offset || g_length != UINT64_MAX) {
+        return COMPRESSION_NONE;
+    }
+
+#ifdef HAVE_ZLIB
+    if (has_suffix(host_file, s_compression_suffix[COMPRESSION_GZIP])) {
+        return COMPRESSION_GZIP;
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    if (has_suffix(host_file, s_compression_suffix[COMPRESSION_ZSTD])) {
+        return COMPRESSION_ZSTD;
+    }
+#endif
+
+    return COMPRESSION_NONE;
+}
+
+///
+/// \brief Remove the suffix of the compressed host file from the given path, in place
+///
+static void strip_compression_suffix(char *path, enum compression_t compression) {
+    if (compression != COMPRESSION_NONE) {
+        path[strlen(path) - strlen(s_compression_suffix[compression])] = 0;
+    }
+}
+
+#ifdef HAVE_ZLIB
+///
+/// \brief Decompress a gzip or zlib host file while it is transferred
+///
+/// The working set is limited to the input and output buffers plus the zlib state, regardless of the file size.
+/// Concatenated gzip members are supported.
+///
+/// \param in the host file
+/// \param fd the destination file descriptor
+/// \param fsize receives the number of decompressed bytes
+/// \param csize receives the number of compressed bytes read from the host
+/// \param holes NULL to write all the data, otherwise receives the number of zero bytes left as holes
+/// \return 0 on success, -1 on failure
+///
+static int copy_gzip(s2e_FILE *in_file, int fd, uint64_t *fsize, uint64_t *csize, uint64_t *holes) {
+    static char in[BUFFER_SIZE];
+    static char out[BUFFER_SIZE];
+    int retval = -1;
+    int ret = Z_OK;
+    int flushing = 0;
+    int stream_end = 0;
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+
+    // Automatically detect gzip and zlib headers
+    if (inflateInit2(&strm, 15 + 32) != Z_OK) {
+        fprintf(stderr, "Could not initialize zlib\n");
+        return -1;
+    }
+
+    while (1) {
+        // Only read more input once zlib has flushed all the output of the previous one
+        if (strm.avail_in == 0 && (!flushing || stream_end)) {
+            int count = s2e_fread(in, 1, sizeof(in), in_file);
+            if (s2e_ferror(in_file)) {
+                fprintf(stderr, "s2e_read failed\n");
+                goto end;
+            } else if (count == 0) {
+                break;
+            }
+
+            *csize += count;
+            strm.next_in = (Bytef *) in;
+            strm.avail_in = count;
+        }
+
+        if (stream_end) {
+            // Start of the next gzip member
+            inflateReset(&strm);
+            stream_end = 0;
+        }
+
+        strm.next_out = (Bytef *) out;
+        strm.avail_out = sizeof(out);
+
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "Could not decompress file: %s\n", strm.msg ? strm.msg : "unknown error");
+            goto end;
+        }
+
+        unsigned count = sizeof(out) - strm.avail_out;
+        if (write_data(fd, out, count, holes) < 0) {
+            goto end;
+        }
+
+        *fsize += count;
+
+        // zlib returns Z_STREAM_END only once all the output of the member was produced, even if it filled the buffer
+        stream_end = ret == Z_STREAM_END;
+        flushing = !stream_end && strm.avail_out == 0;
+    }
+
+    if (!stream_end) {
+        fprintf(stderr, "The compressed file is truncated\n");
+        goto end;
+    }
+
+    retval = holes ? finish_sparse(fd) : 0;
+
+end:
+    inflateEnd(&strm);
+    return retval;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+///
+/// \brief Decompress a zstd host file while it is transferred
+///
+/// The working set is limited to the input and output buffers plus the decompression context.
+///
+/// \param in the host file
+/// \param fd the destination file descriptor
+/// \param fsize receives the number of decompressed bytes
+/// \param csize receives the number of compressed bytes read from the host
+/// \param holes NULL to write all the data, otherwise receives the number of zero bytes left as holes
+/// \return 0 on success, -1 on failure
+///
+static int copy_zstd(s2e_FILE *in_file, int fd, uint64_t *fsize, uint64_t *csize, uint64_t *holes) {
+    static char in[BUFFER_SIZE];
+    static char out[BUFFER_SIZE];
+    int retval = -1;
+    size_t ret = 0;
+    int flushing = 0;
+    int frame_end = 0;
+
+    ZSTD_DStream *dstream = ZSTD_createDStream();
+    if (!dstream) {
+        fprintf(stderr, "Could not initialize zstd\n");
+        return -1;
+    }
+
+    ZSTD_initDStream(dstream);
+
+    ZSTD_inBuffer input = {in, 0, 0};
+
+    while (1) {
+        // Only read more input once zstd has flushed all the output of the previous one
+        if (input.pos == input.size && !flushing) {
+            int count = s2e_fread(in, 1, sizeof(in), in_file);
+            if (s2e_ferror(in_file)) {
+                fprintf(stderr, "s2e_read failed\n");
+                goto end;
+            } else if (count == 0) {
+                break;
+            }
+
+            *csize += count;
+            input.size = count;
+            input.pos = 0;
+        }
+
+        ZSTD_outBuffer output = {out, sizeof(out), 0};
+        ret = ZSTD_decompressStream(dstream, &output, &input);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "Could not decompress file: %s\n", ZSTD_getErrorName(ret));
+            goto end;
+        }
+
+        if (write_data(fd, out, output.pos, holes) < 0) {
+            goto end;
+        }
+
+        *fsize += output.pos;
+
+        // A zero hint means that the frame was fully decoded and flushed, even if it filled the buffer
+        frame_end = ret == 0;
+        flushing = !frame_end && output.pos == output.size;
+    }
+
+    // Otherwise the decoder expects more data
+    if (!frame_end) {
+        fprintf(stderr, "The compressed file is truncated\n");
+        goto end;
+    }
+
+    retval = holes ? finish_sparse(fd) : 0;
+
+end:
+    ZSTD_freeDStream(dstream);
+    return retval;
+}
+#endif
+
+#ifndef _WIN32
+///
+/// \brief Get the path of the cache entry for the given host file
+///
+/// Entries are named after the SHA-256 digest of the host file contents, as computed by the HostFiles plugin.
+/// Decompressed files are cached separately from the raw host files.
+///
+/// \param st the information about the host file
+/// \param compression how the host file is transferred
+/// \return the path of the entry
+///
+static char *get_cache_entry(const struct S2E_HOSTFILES_STAT *st, enum compression_t compression) {
+    char name[sizeof(st->digest) * 2 + 16];
+    for (unsigned i = 0; i < sizeof(st->digest); ++i) {
+        snprintf(name + i * 2, 3, "%02x", st->digest[i]);
+    }
+
+    if (compression != COMPRESSION_NONE) {
+        strcat(name, ".unpacked");
+    }
+
+    return join_path(g_cache_dir, name);
+}
+
+///
+/// \brief Give dst its own copy of the contents of src
+///
+/// A reflink shares the data copy-on-write when the file system supports it, otherwise the data is copied. Neither
+/// file is ever linked to the other, so that modifying the destination in place cannot alter a cache entry. The copy
+/// is written to a temporary file that is renamed into place, so that dst is never seen partially written.
+///
+/// \return 0 on success, -1 on failure
+///
+static int place_file(const char *src, const char *dst) {
+    static char buf[BUFFER_SIZE];
+    int ret = -1;
+    int src_fd = -1;
+    int dst_fd = -1;
+
+    unsigned max_len = strlen(dst) + 32;
+    char *tmp = malloc(max_len);
+    if (!tmp) {
+        return -1;
+    }
+    snprintf(tmp, max_len, "%s.tmp.%d", dst, (int) getpid());
+
+    src_fd = open(src, O_RDONLY);
+    if (src_fd < 0) {
+        goto end;
+    }
+
+    dst_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+    if (dst_fd < 0) {
+        goto end;
+    }
+
+#ifdef FICLONE
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+        ret = 0;
+    }
+#endif
+
+    while (ret < 0) {
+        ssize_t count = read(src_fd, buf, sizeof(buf));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count < 0) {
+            break;
+        } else if (count == 0) {
+            ret = 0;
+        } else if (write_all(dst_fd, buf, count) < 0) {
+            break;
+        }
+    }
+
+end:
+    if (dst_fd >= 0) {
+        if (close(dst_fd) < 0) {
+            ret = -1;
+        }
+
+        if (ret == 0 && rename(tmp, dst) < 0) {
+            ret = -1;
+        }
+
+        if (ret < 0) {
+            unlink(tmp);
+        }
+    }
+
+    if (src_fd >= 0) {
+        close(src_fd);
+    }
+
+    free(tmp);
+    return ret;
+}
+
+///
+/// \brief Place the cached copy of a host file at the destination path
+///
+/// \return 0 if the entry was found and placed, -1 otherwise
+///
+static int copy_from_cache(const char *cache_entry, uint64_t host_size, enum compression_t compression,
+                           const char *path) {
+    struct stat st;
+    if (stat(cache_entry, &st) < 0) {
+        return -1;
+    }
+
+    // The size of decompressed entries is not known in advance
+    if (compression == COMPRESSION_NONE && (uint64_t) st.st_size != host_size) {
+        fprintf(stderr, "Ignoring cache entry %s, its size does not match the host file\n", cache_entry);
+        return -1;
+    }
+
+    return place_file(cache_entry, path);
+}
+#endif
+
 static int copy_file(const char *dest_file, const char *host_file) {
     char *path = NULL;
     int retval = -1;
     int fd = -1;
-    int s2e_fd = -1;
+    s2e_FILE *in = NULL;
+    int to_stdout = 0;
+    char *cache_entry = NULL;
+    enum compression_t compression = get_compression(host_file);
 
     path = get_dest_file(dest_file, host_file);
     if (!path) {
         goto end;
     }
 
-    // Delete anything that already exists at this location
-    unlink(path);
+    if (!dest_file) {
+        strip_compression_suffix(path, compression);
+    }
 
-    // Open the host file path for reading.
-    s2e_fd = s2e_open(host_file);
-    if (s2e_fd < 0) {
-        fprintf(stderr, "s2e_open of %s failed\n", host_file);
-        goto end;
+    to_stdout = !strcmp(path, "-");
+
+    // Delete anything that already exists at this location, unless we continue a previous transfer
+    if (!g_resume && !to_stdout) {
+        unlink(path);
     }
 
-// Open the destination file path for writing
-#ifdef _WIN32
-    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, S_IRWXU);
-#else
-    fd = creat(path, S_IRWXU);
+    // The host hashes the whole file for every stat, so do it only once for both the cache and the checksum
+    struct S2E_HOSTFILES_STAT host_st;
+    memset(&host_st, 0, sizeof(host_st));
+    int have_host_st = s2e_stat(host_file, &host_st) == 0;
+
+#ifndef _WIN32
+    // Ranged and resumed transfers only produce part of the file, they cannot use the cache
+    if (g_cache_dir && have_host_st && !to_stdout && !g_resume && !g_offset && g_length == UINT64_MAX) {
+        cache_entry = get_cache_entry(&host_st, compression);
+        if (cache_entry && copy_from_cache(cache_entry, host_st.size, compression, path) == 0) {
+            fprintf(g_info, "... file %s was found in the cache and placed at %s\n", host_file, path);
+
+            // Don't insert the file again
+            free(cache_entry);
+            cache_entry = NULL;
+
+            retval = 0;
+            goto end;
+        }
+    }
 #endif
-    if (fd < 0) {
-        fprintf(stderr, "Could not create file %s\n", path);
+
+    // Open the host file path for reading. Raw copies already transfer whole chunks, buffering them would only add
+    // a copy. Compressed files are read through the stream buffer.
+    in = s2e_fopen(host_file, "r");
+    if (!in || (compression == COMPRESSION_NONE && s2e_setvbuf(in, 0) < 0)) {
+        fprintf(stderr, "s2e_open of %s failed\n", host_file);
         goto end;
     }
 
-    int fsize = 0;
-    char buf[BUFFER_SIZE] = {0};
+    // Check the data against the checksum of the host file while it is copied, if the HostFiles plugin provides one.
+    // Only transfers that read the whole host file sequentially can be verified.
+    if (have_host_st && (host_st.flags & S2E_HOSTFILES_STAT_CRC32C)) {
+        s2e_fcrc32c_start(in);
+    }
 
-    // Copy and write data from host to guest
-    while (1) {
-        int ret = s2e_read(s2e_fd, buf, sizeof(buf));
-        if (ret == -1) {
-            fprintf(stderr, "s2e_read failed\n");
+    off_t pos = 0;
+
+    if (to_stdout) {
+        // Stream the data to stdout, which is usually a pipe that supports neither mapping nor seeking
+        fd = STDOUT_FILENO;
+    } else {
+// Open the destination file path for writing. Mapping the file requires read access as well.
+#ifdef _WIN32
+        fd = open(path, O_WRONLY | O_CREAT | O_BINARY, S_IRWXU);
+#else
+        fd = open(path, O_RDWR | O_CREAT, S_IRWXU);
+#endif
+        if (fd < 0) {
+            fprintf(stderr, "Could not create file %s\n", path);
             goto end;
-        } else if (ret == 0) {
-            break;
         }
 
-        int ret1 = write(fd, buf, ret);
-        if (ret1 != ret) {
-            fprintf(stderr, "Could not write to file\n");
+        // Skip the data that is already present in the destination file
+        pos = lseek(fd, 0, SEEK_END);
+        if (pos < 0) {
+            fprintf(stderr, "Could not seek in file %s\n", path);
             goto end;
         }
+    }
+
+    uint64_t offset = g_offset + pos;
+    uint64_t length = g_length;
+    if (length != UINT64_MAX) {
+        length = (uint64_t) pos < length ? length - pos : 0;
+    }
+
+    if (offset > 0 && s2e_fseek(in, offset, SEEK_SET) != (int64_t) offset) {
+        fprintf(stderr, "Could not seek to offset %" PRIu64 " of %s. "
+                        "Does the HostFiles plugin support seeking?\n", offset, host_file);
+        goto end;
+    }
+
+    uint64_t fsize = 0;
+    uint64_t csize = 0;
+    uint64_t hole_bytes = 0;
+    int ret = 1;
+
+    // Zero chunks can only be skipped in regular files
+    uint64_t *holes = NULL;
+#ifndef _WIN32
+    struct stat st;
+    if (g_sparse && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        holes = &hole_bytes;
+    }
+#endif
+    const char *method = "buffered";
+    double start = get_time();
+
+#ifdef HAVE_ZLIB
+    if (compression == COMPRESSION_GZIP) {
+        ret = copy_gzip(in, fd, &fsize, &csize, holes);
+        method = "gzip";
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    if (compression == COMPRESSION_ZSTD) {
+        ret = copy_zstd(in, fd, &fsize, &csize, holes);
+        method = "zstd";
+    }
+#endif
+
+#ifndef _WIN32
+    // Compressed files have already been transferred at this point
+    unsigned streams = ret > 0 && !to_stdout ? get_stream_count(in, offset, &length) : 1;
+    if (streams > 1) {
+        ret = copy_parallel(host_file, fd, pos, offset, length, streams, &fsize, holes);
+        method = "parallel";
+    } else if (ret > 0 && g_use_mmap && !to_stdout && !holes) {
+        // Writing through a mapping allocates every page, sparse copies are buffered
+        ret = copy_mmap(in, fd, pos, length, &fsize);
+        method = "mmap";
+    }
+#endif
+
+    if (ret > 0) {
+        ret = copy_buffered(in, fd, length, &fsize, holes);
+        method = "buffered";
+    }
+
+    if (ret < 0) {
+        goto end;
+    }
+
+    uint32_t crc = 0;
+    uint64_t crc_bytes = 0;
+    int verified = s2e_fcrc32c(in, &crc, &crc_bytes) == 0 && crc_bytes == host_st.size;
+    if (verified && crc != host_st.crc32c) {
+        fprintf(stderr, "The checksum of %s does not match the host file (crc32c %08x, expected %08x)\n", path, crc,
+                host_st.crc32c);
+        goto end;
+    }
+
+    double elapsed = get_time() - start;
+    double rate = elapsed > 0 ? fsize / elapsed / (1024 * 1024) : 0;
+
+    fprintf(g_info, "... file %s of size %" PRIu64 " was transferred successfully to %s (%s, %.2f MiB/s)\n", host_file,
+           (uint64_t) pos + fsize, path, method, rate);
+
+#ifndef _WIN32
+    if (streams > 1) {
+        fprintf(g_info, "... used %u streams\n", streams);
+    }
+#endif
+
+    if (compression != COMPRESSION_NONE) {
+        fprintf(g_info, "... decompressed from %" PRIu64 " bytes\n", csize);
+    }
 
-        fsize += ret;
+    if (hole_bytes) {
+        fprintf(g_info, "... %" PRIu64 " bytes of zeros were left as holes\n", hole_bytes);
     }
 
-    printf("... file %s of size %d was transferred successfully to %s\n", host_file, fsize, path);
+    if (verified) {
+        fprintf(g_info, "... crc32c %08x verified\n", crc);
+    }
 
     retval = 0;
 
 end:
-    if (s2e_fd >= 0) {
-        s2e_close(s2e_fd);
+    if (in) {
+        s2e_fclose(in);
     }
 
-    if (fd >= 0) {
+    if (fd >= 0 && !to_stdout) {
         close(fd);
     }
 
-    free(path);
+#ifndef _WIN32
+    if (retval == 0 && cache_entry && place_file(path, cache_entry) < 0) {
+        fprintf(stderr, "Could not add %s to the cache\n", path);
+    }
+#endif
+
+    free(cache_entry);
 
     if (retval < 0) {
-        // There was an error, clean up any partially transferred files
-        if (path) {
+        // There was an error, clean up any partially transferred files. Keep them when resuming, so that the
+        // next attempt can continue from where this one stopped.
+        if (path && !g_resume && !to_stdout) {
             unlink(path);
         }
         retval = -retval;
     }
 
+    free(path);
+
     return retval;
 }
 
+static char *trim(char *str) {
+    while (isspace((unsigned char) *str)) {
+        ++str;
+    }
+
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char) end[-1])) {
+        --end;
+    }
+    *end = 0;
+
+    return str;
+}
+
+///
+/// \brief Transfer all the files listed in the given manifest
+///
+/// Each line of the manifest has the form host_file[:dest_file]. Empty lines and lines starting with # are ignored.
+/// The destination cannot be -, as the progress messages are written to stdout.
+/// A failed transfer is reported and does not prevent the remaining files from being transferred.
+///
+/// \param manifest path to the manifest on the guest, or - to read it from stdin
+/// \return 0 if all the files were transferred successfully, 1 otherwise
+///
+static int copy_manifest(const char *manifest) {
+    FILE *fp = stdin;
+    if (strcmp(manifest, "-")) {
+        fp = fopen(manifest, "r");
+        if (!fp) {
+            fprintf(stderr, "Could not open manifest %s\n", manifest);
+            return 1;
+        }
+    }
+
+    unsigned total = 0, failed = 0;
+    char line[4096];
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *host_file = trim(line);
+        if (!*host_file || *host_file == '#') {
+            continue;
+        }
+
+        const char *dest_file = NULL;
+        char *sep = strchr(host_file, ':');
+        if (sep) {
+            *sep = 0;
+            host_file = trim(host_file);
+            dest_file = trim(sep + 1);
+            if (!*dest_file) {
+                dest_file = NULL;
+            }
+        }
+
+        ++total;
+        if (dest_file && !strcmp(dest_file, "-")) {
+            // Progress messages go to stdout and would get mixed with the data
+            fprintf(stderr, "Writing %s to stdout is not supported in a manifest\n", host_file);
+            ++failed;
+        } else if (copy_file(dest_file, host_file)) {
+            fprintf(stderr, "Could not transfer %s\n", host_file);
+            ++failed;
+        }
+    }
+
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    fprintf(g_info, "... %u of %u files were transferred successfully\n", total - failed, total);
+
+    return failed ? 1 : 0;
+}
+
+///
+/// \brief Mirror a host directory into the guest
+///
+/// Each directory is listed with as few s2e_listdir calls as the transfer buffer allows. A failed transfer is
+/// reported and does not prevent the remaining files from being transferred.
+///
+/// \param dest_dir path of the directory on the guest, created if it does not exist
+/// \param host_dir path of the directory relative to the HostFiles plugin's base directory
+/// \param total incremented with the number of files found
+/// \param failed incremented with the number of files that could not be transferred
+/// \return 0 if the directory could be listed, -1 otherwise
+///
+static int copy_dir(const char *dest_dir, const char *host_dir, unsigned *total, unsigned *failed) {
+    int retval = -1;
+    uint64_t cookie = 0;
+
+    // Recursive calls need their own listing buffer
+    char *buf = malloc(BUFFER_SIZE);
+    if (!buf) {
+        fprintf(stderr, "Could not allocate memory for the directory listing\n");
+        return -1;
+    }
+
+#ifdef _WIN32
+    int ret = mkdir(dest_dir);
+#else
+    int ret = mkdir(dest_dir, S_IRWXU);
+#endif
+    if (ret < 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create directory %s\n", dest_dir);
+        goto end;
+    }
+
+    while (1) {
+        int count = s2e_listdir(host_dir, buf, BUFFER_SIZE, &cookie);
+        if (count < 0) {
+            fprintf(stderr, "s2e_listdir of %s failed\n", host_dir);
+            goto end;
+        } else if (count == 0) {
+            break;
+        }
+
+        const char *entry = buf;
+        const char *buf_end = buf + BUFFER_SIZE;
+        for (int i = 0; i < count; ++i) {
+            // Do not trust the host to have stayed within the buffer
+            const char *name_end = entry + 1 < buf_end ? memchr(entry + 1, 0, buf_end - entry - 1) : NULL;
+            if (!name_end) {
+                fprintf(stderr, "s2e_listdir of %s returned a malformed listing\n", host_dir);
+                goto end;
+            }
+
+            int type = entry[0];
+            const char *name = entry + 1;
+            entry = name_end + 1;
+
+            if (type == S2E_HOSTFILES_DT_OTHER || !strcmp(name, ".") || !strcmp(name, "..")) {
+                continue;
+            }
+
+            char *host_path = join_path(host_dir, name);
+            char *dest_path = join_path(dest_dir, name);
+
+            if (!host_path || !dest_path) {
+                ++*failed;
+            } else if (type == S2E_HOSTFILES_DT_DIR) {
+                if (copy_dir(dest_path, host_path, total, failed) < 0) {
+                    ++*failed;
+                }
+            } else {
+                strip_compression_suffix(dest_path, get_compression(host_path));
+
+                ++*total;
+                if (copy_file(dest_path, host_path)) {
+                    fprintf(stderr, "Could not transfer %s\n", host_path);
+                    ++*failed;
+                }
+            }
+
+            free(host_path);
+            free(dest_path);
+        }
+    }
+
+    retval = 0;
+
+end:
+    free(buf);
+    return retval;
+}
+
+static int copy_recursive(const char *dest_dir, const char *host_dir) {
+    unsigned total = 0, failed = 0;
+
+    char *path = get_dest_file(dest_dir, host_dir);
+    if (!path) {
+        return 1;
+    }
+
+    int ret = copy_dir(path, host_dir, &total, &failed);
+    free(path);
+
+    if (ret < 0) {
+        return 1;
+    }
+
+    fprintf(g_info, "... %u of %u files were transferred successfully\n", total - failed, total);
+
+    return failed ? 1 : 0;
+}
+
 static void print_usage(const char *prog_name) {
-    fprintf(stderr, "Usage: %s [options] host_file [dest_file]\n\n", prog_name);
+    fprintf(stderr, "Usage: %s [options] host_file [dest_file]\n", prog_name);
+    fprintf(stderr, "       %s [options] --manifest manifest_file\n\n", prog_name);
     fprintf(stderr, "host_file      - File path relative to the HostFiles plugin's base directory\n");
-    fprintf(stderr, "dest_file      - File path of the downloaded file on the guest. "
+    fprintf(stderr, "                 .gz and .zst files are decompressed on the fly when supported\n");
+    fprintf(stderr, "dest_file      - File path of the downloaded file on the guest, or - for stdout. "
                     "The directories must already exist [default: working directory]\n");
+    fprintf(stderr, "                 With -r, host_file and dest_file are directories\n");
+    fprintf(stderr, "manifest_file  - File listing one host_file[:dest_file] per line, or - for stdin\n");
     fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --manifest   - Transfer all the files listed in the given manifest\n");
+    fprintf(stderr, "  -o dest_file - Same as the dest_file argument\n");
+    fprintf(stderr, "  --stdout     - Write the file to stdout, same as -o -\n");
+    fprintf(stderr, "  -r           - Recursively transfer the contents of a host directory\n");
+    fprintf(stderr, "  --no-mmap    - Write the file through an intermediate buffer instead of mapping it\n");
+#ifndef _WIN32
+    fprintf(stderr, "  --sparse     - Leave holes in the destination file instead of writing chunks of zeros. "
+                    "Implies --no-mmap\n");
+#endif
+    fprintf(stderr, "  --offset N   - Start reading the host file at offset N\n");
+    fprintf(stderr, "  --length N   - Transfer at most N bytes\n");
+    fprintf(stderr, "  -j N         - Transfer large files with N parallel streams "
+                    "[default: 1, automatic with --no-mmap]\n");
+    fprintf(stderr, "  --cache DIR  - Keep the transferred files in DIR and reuse them when the host file\n");
+    fprintf(stderr, "                 contents did not change. Destination files are reflinks or copies\n");
+    fprintf(stderr, "                 of the cache entries and may be modified in place\n");
+    fprintf(stderr, "  --raw        - Do not decompress files. Implied by --offset, --length and --resume\n");
+    fprintf(stderr, "  --resume     - Continue a previous transfer by appending the missing data to dest_file\n");
+    fprintf(stderr, "  --chunk-size N      - Transfer raw files in chunks of N bytes [default: probed between "
+                    "%u and %u]\n", S2E_CHUNK_SIZE_MIN, S2E_CHUNK_SIZE_MAX);
+    fprintf(stderr, "  --min-chunk-size N  - Smallest chunk size to probe\n");
+    fprintf(stderr, "  --max-chunk-size N  - Largest chunk size to probe\n");
     fprintf(stderr, "  --help       - Display this message\n");
 }
 
@@ -191,6 +1379,96 @@ static int parse_arguments(int argc, const char **argv) {
         if (strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             exit(0);
+        } else if (strcmp(argv[i], "--manifest") == 0) {
+            if (i + 1 >= argc) {
+                return -1;
+            }
+            g_manifest = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            if (i + 1 >= argc) {
+                return -1;
+            }
+            g_dest_file = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--stdout") == 0) {
+            g_dest_file = "-";
+            ++i;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            g_recursive = 1;
+            ++i;
+#ifndef _WIN32
+        } else if (strcmp(argv[i], "--sparse") == 0) {
+            g_sparse = 1;
+            ++i;
+#endif
+        } else if (strcmp(argv[i], "--no-mmap") == 0) {
+            g_use_mmap = 0;
+            ++i;
+        } else if (strcmp(argv[i], "--offset") == 0 || strcmp(argv[i], "--length") == 0) {
+            if (i + 1 >= argc) {
+                return -1;
+            }
+
+            char *end = NULL;
+            uint64_t value = strtoull(argv[i + 1], &end, 0);
+            if (*end || end == argv[i + 1]) {
+                fprintf(stderr, "Invalid number %s\n", argv[i + 1]);
+                return -1;
+            }
+
+            if (!strcmp(argv[i], "--offset")) {
+                g_offset = value;
+            } else {
+                g_length = value;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--chunk-size") == 0 || strcmp(argv[i], "--min-chunk-size") == 0 ||
+                   strcmp(argv[i], "--max-chunk-size") == 0) {
+            if (i + 1 >= argc) {
+                return -1;
+            }
+
+            char *end = NULL;
+            uint64_t value = strtoull(argv[i + 1], &end, 0);
+            if (*end || end == argv[i + 1] || value < MIN_CHUNK_SIZE || value > MAX_CHUNK_SIZE) {
+                fprintf(stderr, "The chunk size must be between %u and %u bytes\n", MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+                return -1;
+            }
+
+            if (!strcmp(argv[i], "--chunk-size")) {
+                g_chunk_size = value;
+            } else if (!strcmp(argv[i], "--min-chunk-size")) {
+                g_min_chunk_size = value;
+            } else {
+                g_max_chunk_size = value;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-j") == 0) {
+            if (i + 1 >= argc) {
+                return -1;
+            }
+
+            int streams = atoi(argv[i + 1]);
+            if (streams < 1 || streams > MAX_STREAMS) {
+                fprintf(stderr, "The number of streams must be between 1 and %d\n", MAX_STREAMS);
+                return -1;
+            }
+
+            g_streams = streams;
+            i += 2;
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            if (i + 1 >= argc) {
+                return -1;
+            }
+            g_cache_dir = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--raw") == 0) {
+            g_raw = 1;
+            ++i;
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            g_resume = 1;
+            ++i;
         } else {
             g_host_file = argv[i++];
 
@@ -198,8 +1476,6 @@ static int parse_arguments(int argc, const char **argv) {
             // the destination file on the guest
             if (i < argc) {
                 g_dest_file = argv[i];
-            } else {
-                g_dest_file = NULL;
             }
 
             // We are done. Don't look for any more arguments
@@ -211,7 +1487,15 @@ static int parse_arguments(int argc, const char **argv) {
 }
 
 static int validate_arguments(void) {
-    if (!g_host_file) {
+    if (!g_host_file == !g_manifest) {
+        return -1;
+    }
+
+    if (g_recursive && g_manifest) {
+        return -1;
+    }
+
+    if (g_recursive && g_dest_file && !strcmp(g_dest_file, "-")) {
         return -1;
     }
 
@@ -229,11 +1513,42 @@ int main(int argc, const char **argv) {
         exit(1);
     }
 
-    printf("Waiting for S2E mode...\n");
-    while (s2e_check() == 0) {
-        // nothing
+    g_info = stdout;
+    if (g_dest_file && !strcmp(g_dest_file, "-")) {
+        g_info = stderr;
+
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#else
+        // Report a closed pipe as a write error instead of being killed by the signal
+        signal(SIGPIPE, SIG_IGN);
+#endif
+    }
+
+    s2e_chunk_tuner_init(&g_tuner, g_min_chunk_size ? g_min_chunk_size : S2E_CHUNK_SIZE_MIN,
+                         g_max_chunk_size ? g_max_chunk_size : s2e_chunk_size_max(), g_chunk_size);
+    if (g_chunk_size) {
+        fprintf(g_info, "... using chunks of %u bytes\n", g_chunk_size);
+    }
+
+#ifndef _WIN32
+    if (g_cache_dir && mkdir(g_cache_dir, S_IRWXU) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create cache directory %s\n", g_cache_dir);
+        exit(1);
+    }
+#endif
+
+    fprintf(g_info, "Waiting for S2E mode...\n");
+    s2e_wait_for_mode(-1);
+    fprintf(g_info, "... S2E mode detected\n");
+
+    if (g_manifest) {
+        return copy_manifest(g_manifest);
+    }
+
+    if (g_recursive) {
+        return copy_recursive(g_dest_file, g_host_file);
     }
-    printf("... S2E mode detected\n");
 
     return copy_file(g_dest_file, g_host_file);
 }
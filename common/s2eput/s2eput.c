@@ -27,36 +27,531 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include <inttypes.h>
 #include <libgen.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
+#ifndef _WIN32
+#include <glob.h>
+#include <signal.h>
+#include <time.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <s2e/hostfiles.h>
 #include <s2e/s2e.h>
 
 #define MIN(x, y) ((x) > (y) ? (y) : (x))
 
 #define BUFFER_SIZE 1024 * 64
 
-/* file is a path relative to the HostFile's base directory */
-static int copy_file(const char *file, int get_example) {
-    int retval = 0;
+// Size of the blocks that are checked for symbolic data, and size under which symbolic blocks are not split further
+#define SYMBOLIC_BLOCK_SIZE 4096
+#define SYMBOLIC_GRANULARITY 64
 
-    // Get the base name of the guest file. Note that this buffer should not be passed to free()
-    const char *guest_file = basename((char *) file);
-    if (!guest_file) {
-        fprintf(stderr, "Could not allocate memory for the file basename\n");
+// Maximum amount of symbolic data that is gathered and concretized at once
+#define SYMBOLIC_BATCH_SIZE (16 * 1024 * 1024)
 
-        retval = -1;
-        goto end;
+// Maximum time to sleep between two checks for new data in follow mode
+#define FOLLOW_POLL_INTERVAL_MS 100
+
+// Limits of the chunk size that can be set on the command line
+#define MIN_CHUNK_SIZE 512
+#define MAX_CHUNK_SIZE 1024 * 1024 * 64
+
+const char **g_files = NULL;
+int g_file_count = 0;
+const char *g_archive = NULL;
+int g_get_example = 0;
+int g_compress = 0;
+int g_follow = 0;
+unsigned g_interval = 1000;
+size_t g_flush_size = BUFFER_SIZE;
+int g_pid = 0;
+const char *g_name_template = "%n";
+int g_atomic = 0;
+
+// Chunk size bounds set on the command line, 0 for the defaults
+unsigned g_chunk_size = 0;
+unsigned g_min_chunk_size = 0;
+unsigned g_max_chunk_size = 0;
+
+// Picks the size of the chunks that are read from files and written to the host
+struct s2e_chunk_tuner_t g_tuner;
+
+static double get_time(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void update_chunk_size(unsigned count) {
+    if (s2e_chunk_tuner_update(&g_tuner, count)) {
+        printf("... chunk size settled at %u bytes (%.2f MiB/s)\n", g_tuner.size, g_tuner.best_rate / (1024 * 1024));
+    }
+}
+
+#ifdef HAVE_ZLIB
+///
+/// \brief Compress the given data and send the output to the host
+///
+/// The output goes through a fixed-size buffer, so memory usage does not depend on the size of the input.
+///
+/// \param out the host file
+/// \param strm the deflate stream
+/// \param data the data to compress
+/// \param size the size of the data
+/// \param flush Z_FINISH for the last piece of data, Z_NO_FLUSH otherwise
+/// \return 0 on success, -1 on failure
+///
+static int write_compressed(s2e_FILE *out_file, z_stream *strm, char *data, size_t size, int flush) {
+    static char out[BUFFER_SIZE];
+
+    strm->next_in = (Bytef *) data;
+    strm->avail_in = size;
+
+    do {
+        strm->next_out = (Bytef *) out;
+        strm->avail_out = sizeof(out);
+
+        if (deflate(strm, flush) == Z_STREAM_ERROR) {
+            fprintf(stderr, "Could not compress file\n");
+            return -1;
+        }
+
+        int count = sizeof(out) - strm->avail_out;
+        if (count > 0 && s2e_fwrite(out, 1, count, out_file) != count) {
+            fprintf(stderr, "s2e_write failed\n");
+            return -1;
+        }
+    } while (strm->avail_out == 0);
+
+    return 0;
+}
+#endif
+
+///
+/// \brief Read up to count bytes, retrying after short reads and interruptions
+///
+/// \return the number of bytes read, which is less than count only at the end of the file, or -1 on failure
+///
+static ssize_t read_full(int fd, char *buf, size_t count) {
+    size_t total = 0;
+
+    while (total < count) {
+        ssize_t ret = read(fd, buf + total, count - total);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        } else if (ret == 0) {
+            break;
+        }
+
+        total += ret;
     }
 
+    return total;
+}
+
+struct symbolic_region_t {
+    uint64_t offset;
+    size_t size;
+
+    // Offset of the concrete data in symbolic_regions_t::data
+    size_t data_offset;
+};
+
+///
+/// \brief Symbolic parts of a file and their concrete values
+///
+struct symbolic_regions_t {
+    struct symbolic_region_t *regions;
+    size_t count;
+    size_t capacity;
+
+    char *data;
+    size_t data_size;
+    size_t data_capacity;
+};
+
+static int add_symbolic_region(struct symbolic_regions_t *r, const char *buf, size_t size, uint64_t offset) {
+    if (r->data_size + size > r->data_capacity) {
+        size_t capacity = r->data_capacity ? r->data_capacity * 2 : BUFFER_SIZE;
+        while (capacity < r->data_size + size) {
+            capacity *= 2;
+        }
+
+        char *data = realloc(r->data, capacity);
+        if (!data) {
+            return -1;
+        }
+        r->data = data;
+        r->data_capacity = capacity;
+    }
+
+    // Copying the bytes preserves their symbolic expressions
+    memcpy(r->data + r->data_size, buf, size);
+    r->data_size += size;
+
+    struct symbolic_region_t *last = r->count ? &r->regions[r->count - 1] : NULL;
+    if (last && last->offset + last->size == offset) {
+        last->size += size;
+        return 0;
+    }
+
+    if (r->count == r->capacity) {
+        size_t capacity = r->capacity ? r->capacity * 2 : 64;
+        struct symbolic_region_t *regions = realloc(r->regions, capacity * sizeof(*regions));
+        if (!regions) {
+            return -1;
+        }
+        r->regions = regions;
+        r->capacity = capacity;
+    }
+
+    r->regions[r->count].offset = offset;
+    r->regions[r->count].size = size;
+    r->regions[r->count].data_offset = r->data_size - size;
+    ++r->count;
+
+    return 0;
+}
+
+///
+/// \brief Record the symbolic parts of the given buffer by bisecting it with s2e_is_symbolic
+///
+/// Concrete bytes cost nothing to concretize, so a buffer is only split while that isolates concrete data: when both
+/// halves are symbolic, the whole buffer is recorded. Densely symbolic data thus costs a few checks per block.
+///
+/// \param r receives the symbolic regions
+/// \param buf the buffer to check
+/// \param size the size of the buffer
+/// \param offset the offset of the buffer in the file
+/// \return 0 on success, -1 if memory could not be allocated
+///
+static int find_symbolic_regions(struct symbolic_regions_t *r, char *buf, size_t size, uint64_t offset) {
+    if (!s2e_is_symbolic(buf, size)) {
+        return 0;
+    }
+
+    while (size > SYMBOLIC_GRANULARITY) {
+        size_t half = size / 2;
+        int low = s2e_is_symbolic(buf, half);
+        int high = s2e_is_symbolic(buf + half, size - half);
+
+        if (low && high) {
+            break;
+        } else if (low) {
+            size = half;
+        } else {
+            buf += half;
+            offset += half;
+            size -= half;
+        }
+    }
+
+    return add_symbolic_region(r, buf, size, offset);
+}
+
+///
+/// \brief Compute concrete values for the symbolic bytes of the next part of a file
+///
+/// Only blocks that contain symbolic data are sent to the solver. Their bytes are gathered in one buffer and
+/// concretized with a single s2e_get_example call, so that all the values come from the same solution. Gathering
+/// stops after SYMBOLIC_BATCH_SIZE bytes of symbolic data, to bound memory usage. The file is then rewound to where
+/// it was, so that the part can be read again and patched with apply_symbolic_regions.
+///
+/// \param fd the file descriptor, which must be seekable
+/// \param r receives the symbolic regions and their concrete values, replacing the previous ones
+/// \param offset the current position in the file
+/// \param end receives the offset of the end of the part that was processed
+/// \return 0 on success, -1 on failure
+///
+static int concretize_symbolic_regions(int fd, struct symbolic_regions_t *r, uint64_t offset, uint64_t *end) {
+    static char buf[BUFFER_SIZE];
+    uint64_t start = offset;
+
+    r->count = 0;
+    r->data_size = 0;
+
+    while (r->data_size < SYMBOLIC_BATCH_SIZE) {
+        ssize_t count = read_full(fd, buf, sizeof(buf));
+        if (count < 0) {
+            fprintf(stderr, "can not read file\n");
+            return -1;
+        }
+
+        for (size_t i = 0; i < count; i += SYMBOLIC_BLOCK_SIZE) {
+            if (find_symbolic_regions(r, buf + i, MIN(SYMBOLIC_BLOCK_SIZE, count - i), offset + i) < 0) {
+                fprintf(stderr, "Could not allocate memory for symbolic data\n");
+                return -1;
+            }
+        }
+
+        offset += count;
+        if (count < sizeof(buf)) {
+            // Past the end of the file, there is nothing left to concretize
+            offset = UINT64_MAX;
+            break;
+        }
+    }
+
+    if (r->data_size > 0) {
+        s2e_get_example(r->data, r->data_size);
+    }
+
+    if (lseek(fd, start, SEEK_SET) < 0) {
+        fprintf(stderr, "can not rewind file\n");
+        return -1;
+    }
+
+    *end = offset;
+    return 0;
+}
+
+///
+/// \brief Overwrite the symbolic bytes of a chunk with their concrete values
+///
+/// \param r the symbolic regions
+/// \param index the first region that may overlap the chunk. Chunks must be processed in order.
+/// \param buf the chunk
+/// \param offset the offset of the chunk in the file
+/// \param size the size of the chunk
+///
+static void apply_symbolic_regions(const struct symbolic_regions_t *r, size_t *index, char *buf, uint64_t offset,
+                                   size_t size) {
+    while (*index < r->count) {
+        const struct symbolic_region_t *region = &r->regions[*index];
+        if (region->offset >= offset + size) {
+            break;
+        }
+
+        uint64_t start = region->offset > offset ? region->offset : offset;
+        uint64_t end = MIN(region->offset + region->size, offset + size);
+        memcpy(buf + (start - offset), r->data + region->data_offset + (start - region->offset), end - start);
+
+        if (region->offset + region->size > offset + size) {
+            // The region continues in the next chunk
+            break;
+        }
+
+        ++*index;
+    }
+}
+
+enum upload_flush_t { UPLOAD_NO_FLUSH, UPLOAD_SYNC_FLUSH, UPLOAD_FINISH };
+
+///
+/// \brief A file being uploaded to the host, optionally compressed
+///
+/// Small writes are coalesced in the stream buffer, which is sized after the current chunk size, so that the host
+/// receives writes of at least that size.
+///
+struct upload_t {
+    s2e_FILE *out;
+    int compress;
+
+    // Name of the file on the host, and the temporary name it is written to until it is complete, if any
+    char name[512];
+    char temp_name[512];
+
+#ifdef HAVE_ZLIB
+    z_stream strm;
+#endif
+
+    // Number of bytes written, before compression
+    uint64_t size;
+};
+
+///
+/// \brief Get the name of a file on the host from g_name_template
+///
+/// %n is replaced by the name of the file, %p by the path id of the current state and %% by %.
+///
+/// \return 0 on success, -1 if the name does not fit in the buffer
+///
+static int format_name(char *buf, size_t size, const char *name, const char *suffix) {
+    size_t len = 0;
+    int ret = 0;
+
+    for (const char *t = g_name_template; *t && ret >= 0 && len < size; ++t) {
+        if (*t != '%' || !t[1]) {
+            ret = snprintf(buf + len, size - len, "%c", *t);
+        } else if (*++t == 'n') {
+            ret = snprintf(buf + len, size - len, "%s", name);
+        } else if (*t == 'p') {
+            ret = snprintf(buf + len, size - len, "%u", s2e_get_path_id());
+        } else {
+            ret = snprintf(buf + len, size - len, "%c", *t);
+        }
+
+        len += ret;
+    }
+
+    if (ret >= 0 && len < size) {
+        ret = snprintf(buf + len, size - len, "%s", suffix);
+        len += ret;
+    }
+
+    if (ret < 0 || len >= size) {
+        fprintf(stderr, "The host file name for %s is too long\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+///
+/// \brief Start uploading a file
+///
+/// \param upload the upload
+/// \param name the name of the file, which is expanded with g_name_template
+/// \param compress whether to compress the data
+/// \param atomic whether to write the data to a temporary file that is renamed once it is complete, so that the
+/// host never sees a partial file
+/// \return 0 on success, -1 on failure
+///
+static int upload_create(struct upload_t *upload, const char *name, int compress, int atomic) {
+    memset(upload, 0, sizeof(*upload));
+    upload->compress = compress;
+
+    if (format_name(upload->name, sizeof(upload->name), name, compress ? ".gz" : "") < 0) {
+        return -1;
+    }
+
+    // The path id keeps the temporary names of the states apart even if they upload files with the same name
+    name = upload->name;
+    if (atomic) {
+        if (snprintf(upload->temp_name, sizeof(upload->temp_name), "%s.tmp-%u", upload->name, s2e_get_path_id()) >=
+            (int) sizeof(upload->temp_name)) {
+            fprintf(stderr, "The host file name for %s is too long\n", upload->name);
+            return -1;
+        }
+        name = upload->temp_name;
+    }
+
+    upload->out = s2e_fopen(name, "w");
+    if (!upload->out) {
+        fprintf(stderr, "s2e_create failed. Does the file %s already exist on the host?\n", name);
+        return -1;
+    }
+
+    if (s2e_setvbuf(upload->out, g_tuner.size) < 0) {
+        fprintf(stderr, "Could not allocate upload buffer\n");
+        s2e_fclose(upload->out);
+        return -1;
+    }
+
+    // Report a checksum of the host file so that it can be verified there. Symbolic data is only concretized by the
+    // HostFiles plugin, checksumming it in the guest would fork, so this requires concrete data.
+    if (compress || g_get_example) {
+        s2e_fcrc32c_start(upload->out);
+    }
+
+#ifdef HAVE_ZLIB
+    // Produce a gzip stream that can be unpacked on the host with the usual tools
+    if (compress &&
+        deflateInit2(&upload->strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "Could not initialize zlib\n");
+        s2e_fclose(upload->out);
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+///
+/// \brief Send data to the host
+///
+/// \param upload the upload
+/// \param buf the data, which must be concrete when compressing
+/// \param count the size of the data
+/// \param flush UPLOAD_SYNC_FLUSH makes all the data written so far available on the host,
+/// UPLOAD_FINISH must be used for the last piece of data
+/// \return 0 on success, -1 on failure
+///
+static int upload_write(struct upload_t *upload, char *buf, size_t count, enum upload_flush_t flush) {
+    upload->size += count;
+
+#ifdef HAVE_ZLIB
+    if (upload->compress) {
+        static const int zflush[] = {Z_NO_FLUSH, Z_SYNC_FLUSH, Z_FINISH};
+        if (write_compressed(upload->out, &upload->strm, buf, count, zflush[flush]) < 0) {
+            return -1;
+        }
+    }
+#endif
+
+    if (!upload->compress && count > 0 && s2e_fwrite(buf, 1, count, upload->out) != count) {
+        fprintf(stderr, "s2e_write failed\n");
+        return -1;
+    }
+
+    if (flush != UPLOAD_NO_FLUSH && s2e_fflush(upload->out) < 0) {
+        fprintf(stderr, "s2e_write failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+///
+/// \brief Finish an upload, and give the file its final name if it was written to a temporary one
+///
+/// \return 0 on success, -1 on failure
+///
+static int upload_close(struct upload_t *upload, int success) {
+#ifdef HAVE_ZLIB
+    if (upload->compress) {
+        if (success) {
+            printf("... compressed to %lu bytes\n", upload->strm.total_out);
+        }
+        deflateEnd(&upload->strm);
+    }
+#endif
+
+    uint32_t crc;
+    uint64_t bytes;
+    if (success && s2e_fcrc32c(upload->out, &crc, &bytes) == 0) {
+        printf("... crc32c of the host file is %08x (%" PRIu64 " bytes)\n", crc, bytes);
+    }
+
+    if (s2e_fclose(upload->out) < 0) {
+        fprintf(stderr, "s2e_write failed\n");
+        success = 0;
+    }
+
+    if (success && upload->temp_name[0] && s2e_rename(upload->temp_name, upload->name) < 0) {
+        // Keep the data rather than lose it
+        fprintf(stderr, "Could not rename %s to %s on the host, the data was kept in %s\n", upload->temp_name,
+                upload->name, upload->temp_name);
+        success = 0;
+    }
+
+    return success ? 0 : -1;
+}
+
+static int open_file(const char *file) {
     int oflags = O_RDONLY;
 #ifdef _WIN32
     oflags |= O_BINARY;
@@ -65,133 +560,832 @@ static int copy_file(const char *file, int get_example) {
     int fd = open(file, oflags);
     if (fd == -1) {
         fprintf(stderr, "cannot open file %s\n", file);
+    }
+
+    return fd;
+}
+
+///
+/// \brief Upload the contents of a file, concretizing them if requested
+///
+/// The file is streamed in fixed-size chunks, so that memory usage does not depend on the file size.
+///
+/// \param upload the upload
+/// \param fd the file descriptor, positioned at the start of the file
+/// \param file the path of the file, for messages
+/// \param length the maximum number of bytes to send
+/// \param sent receives the number of bytes sent
+/// \return 0 on success, -1 on failure
+///
+static int send_file(struct upload_t *upload, int fd, const char *file, uint64_t length, uint64_t *sent) {
+    // Large enough for any size the tuner may pick
+    static char *buf = NULL;
+    if (!buf) {
+        if (!(buf = calloc(1, g_tuner.max))) {
+            fprintf(stderr, "Could not allocate transfer buffer\n");
+            return -1;
+        }
+
+        // The buffer is used for every chunk
+        s2e_make_resident(buf, g_tuner.max);
+    }
+
+    int retval = 0;
+
+    // Compressing symbolic data would fork on every byte, always concretize it first
+    struct symbolic_regions_t regions;
+    memset(&regions, 0, sizeof(regions));
+    size_t region_index = 0;
+    int concretize = g_get_example || g_compress;
+    int chunk_example = 0;
+    uint64_t regions_end = 0;
+    unsigned batches = 0;
+
+    if (concretize && lseek(fd, 0, SEEK_CUR) < 0) {
+        // The file cannot be read twice, concretize every chunk independently instead
+        fprintf(stderr, "Warning: %s is not seekable, its chunks are concretized independently "
+                        "and may come from different solutions\n", file);
+        chunk_example = 1;
+    }
+
+    uint64_t offset = 0;
+    int eof = 0;
+
+    while (!eof && offset < length) {
+        if (concretize && !chunk_example && offset >= regions_end) {
+            if (++batches == 2) {
+                fprintf(stderr, "Warning: %s has more than %d MiB of symbolic data, it is concretized in batches "
+                                "that may come from different solutions\n", file, SYMBOLIC_BATCH_SIZE >> 20);
+            }
+
+            if (concretize_symbolic_regions(fd, &regions, offset, &regions_end) < 0) {
+                retval = -1;
+                break;
+            }
+            region_index = 0;
+        }
+
+        // Do not read past the data whose symbolic bytes are known
+        uint64_t limit = concretize && !chunk_example ? MIN(length, regions_end) : length;
+        size_t size = MIN(g_tuner.size, limit - offset);
+        ssize_t count = read_full(fd, buf, size);
+        if (count < 0) {
+            fprintf(stderr, "can not read file\n");
+
+            retval = -1;
+            break;
+        }
+
+        eof = count < size;
+
+        if (chunk_example && count > 0) {
+            s2e_get_example(buf, count);
+        } else {
+            apply_symbolic_regions(&regions, &region_index, buf, offset, count);
+        }
+
+        if (upload_write(upload, buf, count, UPLOAD_NO_FLUSH) < 0) {
+            retval = -1;
+            break;
+        }
+
+        offset += count;
+        update_chunk_size(count);
+    }
+
+    free(regions.regions);
+    free(regions.data);
+
+    *sent = offset;
+    return retval;
+}
+
+/* file is a path relative to the HostFile's base directory */
+static int copy_file(const char *file) {
+    int retval = 0;
+    struct upload_t *upload = NULL;
+
+    // Get the base name of the guest file. Note that this buffer should not be passed to free()
+    const char *guest_file = basename((char *) file);
+    if (!guest_file) {
+        fprintf(stderr, "Could not allocate memory for the file basename\n");
 
         retval = -1;
         goto end;
     }
 
-    int s2e_fd = s2e_create(guest_file);
-    if (s2e_fd == -1) {
-        fprintf(stderr, "s2e_create failed. Does the file %s already exist on the host?\n", guest_file);
+    int fd = open_file(file);
+    if (fd == -1) {
+        retval = -1;
+        goto end;
+    }
 
+    upload = malloc(sizeof(*upload));
+    if (!upload || upload_create(upload, guest_file, g_compress, g_atomic) < 0) {
         retval = -1;
         goto fd_cleanup;
     }
 
-    struct stat st;
-    stat(file, &st);
-
-    char *buf = malloc(st.st_size);
-    if (!buf) {
-        fprintf(stderr, "Could not allocate %lu bytes\n", st.st_size);
+    uint64_t size = 0;
+    if (send_file(upload, fd, file, UINT64_MAX, &size) < 0 || upload_write(upload, NULL, 0, UPLOAD_FINISH) < 0) {
+        retval = -1;
+    }
 
+    if (upload_close(upload, retval == 0) < 0) {
         retval = -1;
-        goto s2e_fd_cleanup;
     }
 
-    int ret = read(fd, buf, st.st_size);
-    if (ret != st.st_size) {
-        fprintf(stderr, "can not read file\n");
+    if (retval == 0) {
+        printf("... file %s of size %" PRIu64 " was transferred successfully to %s\n", file, size, upload->name);
+    }
 
-        retval = -1;
-        goto buf_cleanup;
+fd_cleanup:
+    free(upload);
+    close(fd);
+
+end:
+    if (retval < 0) {
+        retval = -retval;
+    }
+
+    return retval;
+}
+
+// Size of the blocks of a tar archive
+#define TAR_BLOCK_SIZE 512
+
+///
+/// \brief Header of a ustar archive member
+///
+struct tar_header_t {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+///
+/// \brief Store a number in a header field, switching to the GNU base-256 encoding when it does not fit in octal
+///
+static void tar_set_number(char *field, size_t size, uint64_t value) {
+    if (value < (1ULL << (3 * (size - 1)))) {
+        field[size - 1] = 0;
+        for (size_t i = size - 1; i > 0; --i, value >>= 3) {
+            field[i - 1] = '0' + (value & 7);
+        }
+        return;
     }
 
-    if (get_example) {
-        // Have to call s2e_get_example for the whole file at once as it doesn't add constraints.
-        // Calling s2e_concretize produces silent concretization warnings.
-        s2e_get_example(buf, st.st_size);
+    memset(field, 0, size);
+    field[0] = (char) 0x80;
+    for (size_t i = size - 1; i > 0 && value; --i, value >>= 8) {
+        field[i] = value & 0xff;
     }
+}
 
-    off_t off = 0;
-    while (off < st.st_size) {
-        size_t to_send = MIN(BUFFER_SIZE, st.st_size - off);
-        ret = s2e_write(s2e_fd, buf + off, to_send);
-        if (ret != to_send) {
-            fprintf(stderr, "s2e_write failed\n");
+static int tar_pad(struct upload_t *upload, uint64_t size) {
+    static char zeros[TAR_BLOCK_SIZE];
+    size_t remainder = size % TAR_BLOCK_SIZE;
+    if (!remainder) {
+        return 0;
+    }
+
+    return upload_write(upload, zeros, TAR_BLOCK_SIZE - remainder, UPLOAD_NO_FLUSH);
+}
+
+///
+/// \brief Write the header of an archive member
+///
+/// Names that do not fit in the header are stored in a preceding GNU long name member.
+///
+/// \param upload the upload
+/// \param name the name of the member
+/// \param st the attributes of the member
+/// \param typeflag the type of the member
+/// \param linkname the target of symbolic links, or NULL
+/// \param size the size of the data that follows the header
+/// \return 0 on success, -1 on failure
+///
+static int tar_write_header(struct upload_t *upload, const char *name, const struct stat *st, char typeflag,
+                            const char *linkname, uint64_t size) {
+    struct tar_header_t header;
+    memset(&header, 0, sizeof(header));
+
+    size_t name_len = strlen(name);
+    size_t linkname_len = linkname ? strlen(linkname) : 0;
 
+    if (name_len >= sizeof(header.name) || linkname_len >= sizeof(header.linkname)) {
+        const char *long_names[] = {name, linkname};
+        const size_t long_lens[] = {name_len, linkname_len};
+        const char long_types[] = {'L', 'K'};
+
+        for (int i = 0; i < 2; ++i) {
+            if (long_lens[i] < sizeof(header.name)) {
+                continue;
+            }
+
+            struct stat long_st;
+            memset(&long_st, 0, sizeof(long_st));
+            if (tar_write_header(upload, "././@LongLink", &long_st, long_types[i], NULL, long_lens[i] + 1) < 0 ||
+                upload_write(upload, (char *) long_names[i], long_lens[i] + 1, UPLOAD_NO_FLUSH) < 0 ||
+                tar_pad(upload, long_lens[i] + 1) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    // Truncated names are replaced by the long name members
+    memcpy(header.name, name, MIN(name_len, sizeof(header.name)));
+    if (linkname) {
+        memcpy(header.linkname, linkname, MIN(linkname_len, sizeof(header.linkname)));
+    }
+
+    tar_set_number(header.mode, sizeof(header.mode), st->st_mode & 07777);
+    tar_set_number(header.uid, sizeof(header.uid), st->st_uid);
+    tar_set_number(header.gid, sizeof(header.gid), st->st_gid);
+    tar_set_number(header.size, sizeof(header.size), size);
+    tar_set_number(header.mtime, sizeof(header.mtime), st->st_mtime > 0 ? st->st_mtime : 0);
+    header.typeflag = typeflag;
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    unsigned checksum = 0;
+    for (size_t i = 0; i < sizeof(header); ++i) {
+        checksum += ((unsigned char *) &header)[i];
+    }
+    snprintf(header.checksum, sizeof(header.checksum), "%06o", checksum);
+
+    return upload_write(upload, (char *) &header, sizeof(header), UPLOAD_NO_FLUSH);
+}
+
+///
+/// \brief Get the name of the archive member for the given path
+///
+/// Empty, "." and ".." components are dropped anywhere in the path, so that extracting the archive can never write
+/// outside of the extraction directory.
+///
+/// \param path the path of the file
+/// \return the name, which must be freed, or NULL if out of memory
+///
+static char *tar_member_name(const char *path) {
+#ifdef _WIN32
+    const char *separators = "/\\";
+#else
+    const char *separators = "/";
+#endif
+
+    char *name = malloc(strlen(path) + 1);
+    if (!name) {
+        return NULL;
+    }
+
+    size_t len = 0;
+    while (*path) {
+        size_t n = strcspn(path, separators);
+        if (n && strncmp(path, ".", n) && strncmp(path, "..", n)) {
+            if (len) {
+                name[len++] = '/';
+            }
+            memcpy(name + len, path, n);
+            len += n;
+        }
+
+        path += n;
+        path += strspn(path, separators);
+    }
+
+    name[len] = 0;
+    return name;
+}
+
+static int tar_add_member(struct upload_t *upload, const char *path, const char *name, unsigned *failed);
+
+///
+/// \brief Add a file, or a directory and its contents, to the archive
+///
+/// Members are named after the given path, as returned by \c tar_member_name.
+/// Files that cannot be read are reported and skipped.
+///
+/// \param upload the upload
+/// \param path the path of the file
+/// \param failed incremented with the number of files that could not be archived
+/// \return 0 on success, -1 if the upload failed
+///
+static int tar_add(struct upload_t *upload, const char *path, unsigned *failed) {
+    char *name = tar_member_name(path);
+    if (!name) {
+        return -1;
+    }
+
+    int ret = tar_add_member(upload, path, name, failed);
+    free(name);
+    return ret;
+}
+
+static int tar_add_member(struct upload_t *upload, const char *path, const char *name, unsigned *failed) {
+
+    struct stat st;
+#ifdef _WIN32
+    int ret = stat(path, &st);
+#else
+    int ret = lstat(path, &st);
+#endif
+    if (ret < 0) {
+        fprintf(stderr, "cannot stat file %s\n", path);
+        ++*failed;
+        return 0;
+    }
+
+#ifndef _WIN32
+    if (S_ISLNK(st.st_mode)) {
+        char target[4096];
+        ssize_t len = readlink(path, target, sizeof(target) - 1);
+        if (len < 0) {
+            fprintf(stderr, "cannot read link %s\n", path);
+            ++*failed;
+            return 0;
+        }
+        target[len] = 0;
+
+        return tar_write_header(upload, name, &st, '2', target, 0);
+    }
+#endif
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (!dir) {
+            fprintf(stderr, "cannot open directory %s\n", path);
+            ++*failed;
+            return 0;
+        }
+
+        int retval = 0;
+
+        // Directory members are named with a trailing slash
+        size_t len = strlen(name);
+        char *dir_name = malloc(len + 2);
+        if (!dir_name) {
+            retval = -1;
+            goto dir_end;
+        }
+        snprintf(dir_name, len + 2, len && name[len - 1] != '/' ? "%s/" : "%s", name);
+
+        if (*name && tar_write_header(upload, dir_name, &st, '5', NULL, 0) < 0) {
             retval = -1;
-            goto buf_cleanup;
+            goto dir_end;
         }
-        off += ret;
+
+        struct dirent *entry;
+        while (retval == 0 && (entry = readdir(dir))) {
+            if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) {
+                continue;
+            }
+
+            size_t max_len = strlen(path) + strlen(entry->d_name) + 2;
+            char *child = malloc(max_len);
+            if (!child) {
+                retval = -1;
+                break;
+            }
+            snprintf(child, max_len, path[strlen(path) - 1] == '/' ? "%s%s" : "%s/%s", path, entry->d_name);
+
+            retval = tar_add(upload, child, failed);
+            free(child);
+        }
+
+    dir_end:
+        free(dir_name);
+        closedir(dir);
+        return retval;
     }
 
-    printf("... file %s of size %lu was transferred successfully\n", file, st.st_size);
+    if (!S_ISREG(st.st_mode)) {
+        fprintf(stderr, "Skipping %s, it is not a regular file\n", path);
+        return 0;
+    }
 
-buf_cleanup:
-    free(buf);
+    int fd = open_file(path);
+    if (fd == -1) {
+        ++*failed;
+        return 0;
+    }
 
-s2e_fd_cleanup:
-    s2e_close(s2e_fd);
+    // The size in the header is authoritative, a file that shrinks meanwhile is padded with zeros
+    uint64_t size = st.st_size;
+    uint64_t sent = 0;
+    int retval = tar_write_header(upload, name, &st, '0', NULL, size);
+    if (retval == 0) {
+        retval = send_file(upload, fd, path, size, &sent);
+    }
+
+    static char zeros[TAR_BLOCK_SIZE];
+    while (retval == 0 && sent < size) {
+        size_t count = MIN(sizeof(zeros), size - sent);
+        retval = upload_write(upload, zeros, count, UPLOAD_NO_FLUSH);
+        sent += count;
+    }
+
+    if (retval == 0) {
+        retval = tar_pad(upload, size);
+    }
 
-fd_cleanup:
     close(fd);
+    return retval;
+}
+
+///
+/// \brief Upload files and directories as a single tar archive
+///
+/// This creates only one file on the host, which receives large sequential writes, instead of one file per upload.
+///
+/// \param archive the name of the archive on the host
+/// \param files the files and directories to archive
+/// \param count the number of files
+/// \return 0 on success, 1 on failure
+///
+static int copy_archive(const char *archive, const char **files, int count) {
+    int retval = -1;
+    unsigned failed = 0;
+
+    struct upload_t *upload = malloc(sizeof(*upload));
+    if (!upload || upload_create(upload, archive, g_compress, g_atomic) < 0) {
+        free(upload);
+        return 1;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (tar_add(upload, files[i], &failed) < 0) {
+            goto end;
+        }
+    }
+
+    // The archive ends with two empty blocks
+    static char zeros[TAR_BLOCK_SIZE * 2];
+    if (upload_write(upload, zeros, sizeof(zeros), UPLOAD_FINISH) < 0) {
+        goto end;
+    }
+
+    retval = 0;
 
 end:
-    if (retval < 0) {
-        retval = -retval;
+    if (upload_close(upload, retval == 0) < 0) {
+        retval = -1;
     }
 
-    return retval;
+    if (retval == 0) {
+        printf("... archive %s of size %" PRIu64 " was transferred successfully\n", upload->name, upload->size);
+        if (failed) {
+            fprintf(stderr, "%u files could not be archived\n", failed);
+        }
+    }
+
+    free(upload);
+    return retval == 0 && !failed ? 0 : 1;
+}
+
+#ifndef _WIN32
+static volatile sig_atomic_t s_stop = 0;
+
+static void stop_handler(int signal) {
+    s_stop = 1;
+}
+
+///
+/// \brief Upload the data that is appended to a file, until asked to stop
+///
+/// New data is sent in batches, whenever g_flush_size bytes are pending or g_interval milliseconds have elapsed
+/// since the last batch. Following stops after SIGINT or SIGTERM, or once the process g_pid has exited, after all
+/// the remaining data has been sent. Each batch is concretized separately, since the file keeps changing.
+///
+static int follow_file(const char *file) {
+    int retval = -1;
+    struct upload_t upload;
+    char *buf = NULL;
+
+    const char *guest_file = basename((char *) file);
+    if (!guest_file) {
+        fprintf(stderr, "Could not allocate memory for the file basename\n");
+        return 1;
+    }
+
+    int fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "cannot open file %s\n", file);
+        return 1;
+    }
+
+    // The data is flushed to the host as it comes, it cannot be held back under a temporary name
+    if (upload_create(&upload, guest_file, g_compress, 0) < 0) {
+        close(fd);
+        return 1;
+    }
+
+    buf = malloc(g_flush_size);
+    if (!buf) {
+        fprintf(stderr, "Could not allocate %zu bytes\n", g_flush_size);
+        goto end;
+    }
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    size_t pending = 0;
+    off_t pos = 0;
+    double last_flush = get_time();
+
+    while (1) {
+        // Check this before reading, so that the data written by the process before exiting is still sent
+        int stop = s_stop || (g_pid && kill(g_pid, 0) < 0 && errno == ESRCH);
+
+        ssize_t count = read(fd, buf + pending, g_flush_size - pending);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "can not read file\n");
+            goto end;
+        }
+
+        pending += count;
+        pos += count;
+
+        struct stat st;
+        if (count == 0 && fstat(fd, &st) == 0 && st.st_size < pos) {
+            fprintf(stderr, "%s was truncated, following it from the start\n", file);
+            lseek(fd, 0, SEEK_SET);
+            pos = 0;
+            continue;
+        }
+
+        // Everything has been read after being asked to stop
+        int last = stop && count == 0;
+
+        double now = get_time();
+        if (last || pending == g_flush_size || (pending > 0 && (now - last_flush) * 1000 >= g_interval)) {
+            if (pending > 0 && (g_get_example || g_compress)) {
+                s2e_get_example(buf, pending);
+            }
+
+            if (upload_write(&upload, buf, pending, last ? UPLOAD_FINISH : UPLOAD_SYNC_FLUSH) < 0) {
+                goto end;
+            }
+
+            pending = 0;
+            last_flush = now;
+        }
+
+        if (last) {
+            break;
+        }
+
+        if (count == 0) {
+            unsigned ms = g_interval < FOLLOW_POLL_INTERVAL_MS ? g_interval : FOLLOW_POLL_INTERVAL_MS;
+            struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    printf("... followed file %s, %" PRIu64 " bytes were transferred successfully\n", file, upload.size);
+    retval = 0;
+
+end:
+    if (upload_close(&upload, retval == 0) < 0) {
+        retval = -1;
+    }
+    free(buf);
+    close(fd);
+
+    return -retval;
 }
+#endif
 
 static void print_usage(const char *prog_name) {
-    fprintf(stderr, "Usage: %s [options] file_name\n", prog_name);
-    fprintf(stderr, "file_name    - File path of the file to upload to the host\n");
+    fprintf(stderr, "Usage: %s [options] file_name...\n", prog_name);
+    fprintf(stderr, "file_name    - File path of the file to upload to the host. Several files, directories and "
+                    "patterns are uploaded as a single tar archive\n");
     fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -a name    - Upload the files as a tar archive with the given name on the host "
+                    "[default: first file name followed by .tar]\n");
     fprintf(stderr, "  -e         - Concertize the data before writing it to the file\n");
+    fprintf(stderr, "  --name-template T - Name of the files on the host. %%n is replaced by the file name, %%p by the "
+                    "path id of the state and %%%% by %% [default: %%n]\n");
+    fprintf(stderr, "  --per-state       - Prefix the names of the files on the host with the path id of the state, "
+                    "same as --name-template %%p-%%n\n");
+    fprintf(stderr, "  --atomic          - Write each file to a temporary name on the host and rename it once it is "
+                    "complete. Requires a HostFiles plugin that supports renaming\n");
+#ifdef HAVE_ZLIB
+    fprintf(stderr, "  -z         - Compress the data and upload it as file_name.gz. Implies -e\n");
+#endif
+#ifndef _WIN32
+    fprintf(stderr, "  --follow   - Keep uploading the data appended to the file until interrupted\n");
+    fprintf(stderr, "  --interval MS   - With --follow, maximum delay before uploading new data [default: %u]\n",
+            g_interval);
+    fprintf(stderr, "  --flush-size N  - With --follow, upload new data as soon as N bytes are available "
+                    "[default: %zu]\n", g_flush_size);
+    fprintf(stderr, "  --pid PID       - With --follow, stop once the given process has exited\n");
+#endif
+    fprintf(stderr, "  --chunk-size N      - Read and upload files in chunks of N bytes [default: probed between "
+                    "%u and %u]\n", S2E_CHUNK_SIZE_MIN, S2E_CHUNK_SIZE_MAX);
+    fprintf(stderr, "  --min-chunk-size N  - Smallest chunk size to probe\n");
+    fprintf(stderr, "  --max-chunk-size N  - Largest chunk size to probe\n");
     fprintf(stderr, "  --help     - Display this message\n");
 }
 
-static int parse_arguments(int argc, const char **argv, const char **file, int *get_example) {
+static int parse_arguments(int argc, const char **argv) {
     if (argc < 2) {
         return -1;
     }
 
-    for (int i = 1; i < argc - 1; i++) {
-        if (strcmp(argv[i], "--help") == 0) {
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            ++i;
+            break;
+        } else if (strcmp(argv[i], "--help") == 0) {
             print_usage(argv[0]);
             exit(0);
         } else if (strcmp(argv[i], "-e") == 0) {
-            *get_example = 1;
+            g_get_example = 1;
+        } else if ((strcmp(argv[i], "--chunk-size") == 0 || strcmp(argv[i], "--min-chunk-size") == 0 ||
+                    strcmp(argv[i], "--max-chunk-size") == 0) &&
+                   i + 1 < argc) {
+            char *end = NULL;
+            uint64_t value = strtoull(argv[i + 1], &end, 0);
+            if (*end || end == argv[i + 1] || value < MIN_CHUNK_SIZE || value > MAX_CHUNK_SIZE) {
+                fprintf(stderr, "The chunk size must be between %u and %u bytes\n", MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+                return -1;
+            }
+
+            if (!strcmp(argv[i], "--chunk-size")) {
+                g_chunk_size = value;
+            } else if (!strcmp(argv[i], "--min-chunk-size")) {
+                g_min_chunk_size = value;
+            } else {
+                g_max_chunk_size = value;
+            }
+            ++i;
+        } else if (strcmp(argv[i], "--name-template") == 0 && i + 1 < argc) {
+            g_name_template = argv[++i];
+        } else if (strcmp(argv[i], "--per-state") == 0) {
+            g_name_template = "%p-%n";
+        } else if (strcmp(argv[i], "--atomic") == 0) {
+            g_atomic = 1;
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            g_archive = argv[++i];
+#ifdef HAVE_ZLIB
+        } else if (strcmp(argv[i], "-z") == 0) {
+            g_compress = 1;
+#endif
+#ifndef _WIN32
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            g_follow = 1;
+        } else if ((strcmp(argv[i], "--interval") == 0 || strcmp(argv[i], "--flush-size") == 0 ||
+                    strcmp(argv[i], "--pid") == 0) &&
+                   i + 1 < argc) {
+            char *end = NULL;
+            uint64_t value = strtoull(argv[i + 1], &end, 0);
+            if (*end || end == argv[i + 1] || value == 0) {
+                fprintf(stderr, "Invalid value for %s: %s\n", argv[i], argv[i + 1]);
+                return -1;
+            }
+
+            if (!strcmp(argv[i], "--interval")) {
+                g_interval = value > UINT_MAX ? UINT_MAX : value;
+            } else if (!strcmp(argv[i], "--flush-size")) {
+                g_flush_size = value > SIZE_MAX ? SIZE_MAX : value;
+            } else if (value > INT_MAX) {
+                fprintf(stderr, "Invalid value for %s: %s\n", argv[i], argv[i + 1]);
+                return -1;
+            } else {
+                g_pid = value;
+            }
+            ++i;
+#endif
         } else {
             fprintf(stderr, "invalid option: %s\n", argv[i]);
             return -1;
         }
     }
 
-    *file = argv[argc - 1];
+    g_files = argv + i;
+    g_file_count = argc - i;
 
     return 0;
 }
 
-static int validate_arguments(const char *file) {
-    if (!file) {
+static int validate_arguments(void) {
+    if (g_file_count < 1) {
+        return -1;
+    }
+
+    if (g_follow && (g_file_count > 1 || g_archive)) {
+        fprintf(stderr, "--follow only supports one file\n");
         return -1;
     }
 
     return 0;
 }
 
-int main(int argc, const char **argv) {
-    const char *file = NULL;
-    int get_example = 0;
+#ifndef _WIN32
+///
+/// \brief Expand the file arguments that do not exist but match files as a glob pattern
+///
+/// This lets callers that do not go through a shell, or need to avoid argument length limits, pass patterns.
+///
+static int expand_patterns(void) {
+    const char **files = NULL;
+    int count = 0;
+
+    for (int i = 0; i < g_file_count; ++i) {
+        glob_t g;
+        memset(&g, 0, sizeof(g));
 
-    if (parse_arguments(argc, argv, &file, &get_example) < 0) {
+        struct stat st;
+        int matched = lstat(g_files[i], &st) < 0 && glob(g_files[i], 0, NULL, &g) == 0;
+        size_t added = matched ? g.gl_pathc : 1;
+
+        const char **new_files = realloc(files, (count + added) * sizeof(*files));
+        if (!new_files) {
+            fprintf(stderr, "Could not allocate memory for the file list\n");
+            free(files);
+            return -1;
+        }
+        files = new_files;
+
+        // The matches are used until the program exits, the glob results are not freed
+        for (size_t j = 0; j < added; ++j) {
+            files[count++] = matched ? g.gl_pathv[j] : g_files[i];
+        }
+    }
+
+    g_files = files;
+    g_file_count = count;
+    return 0;
+}
+#endif
+
+int main(int argc, const char **argv) {
+    if (parse_arguments(argc, argv) < 0) {
         print_usage(argv[0]);
         exit(1);
     }
 
-    if (validate_arguments(file) < 0) {
+    if (validate_arguments() < 0) {
         print_usage(argv[0]);
         exit(1);
     }
 
-    printf("Waiting for S2E mode...\n");
-    while (s2e_check() == 0) {
-        // nothing
+    s2e_chunk_tuner_init(&g_tuner, g_min_chunk_size ? g_min_chunk_size : S2E_CHUNK_SIZE_MIN,
+                         g_max_chunk_size ? g_max_chunk_size : s2e_chunk_size_max(), g_chunk_size);
+    if (g_chunk_size) {
+        printf("... using chunks of %u bytes\n", g_chunk_size);
     }
+
+    printf("Waiting for S2E mode...\n");
+    s2e_wait_for_mode(-1);
     printf("... S2E mode detected\n");
 
-    return copy_file(file, get_example);
+#ifndef _WIN32
+    if (g_follow) {
+        return follow_file(g_files[0]);
+    }
+
+    if (expand_patterns() < 0) {
+        exit(1);
+    }
+#endif
+
+    struct stat st;
+    if (!g_archive && g_file_count == 1 && (stat(g_files[0], &st) < 0 || !S_ISDIR(st.st_mode))) {
+        return copy_file(g_files[0]);
+    }
+
+    char archive[512];
+    if (!g_archive) {
+        // Name the archive after the first file, e.g. results/ becomes results.tar
+        char first[512];
+        snprintf(first, sizeof(first), "%s", g_files[0]);
+        for (size_t len = strlen(first); len > 1 && first[len - 1] == '/'; --len) {
+            first[len - 1] = 0;
+        }
+
+        snprintf(archive, sizeof(archive), "%s.tar", basename(first));
+        g_archive = archive;
+    }
+
+    return copy_archive(g_archive, g_files, g_file_count);
 }
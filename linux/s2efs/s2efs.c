@@ -0,0 +1,553 @@
+/*
+ * S2E Selective Symbolic Execution Platform
+ *
+ * Copyright (c) 2017 Cyberhaven
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+///
+/// s2efs mounts the base directory of the HostFiles plugin in the guest, so that programs can read host files in
+/// place instead of copying them with s2eget first.
+///
+/// Host files are read-only. Opening a file for writing, with O_CREAT or O_TRUNC, creates a new file with the same
+/// name in the output directory of the HostFiles plugin, like s2eput does. Files created this way are visible through
+/// the mount point until it is unmounted, but their contents cannot be read back.
+///
+
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION 26
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fuse.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <s2e/hostfiles.h>
+#include <s2e/s2e.h>
+
+// Bounds of the readahead window. Random reads use the smallest window, which doubles with every sequential read.
+#define READAHEAD_MIN (128 * 1024)
+#define READAHEAD_MAX (4 * 1024 * 1024)
+
+// Amount of written data that is collected before it is sent to the host
+#define WRITE_BEHIND_SIZE (1024 * 1024)
+
+// Size of the buffer that receives directory listings
+#define LISTDIR_BUFFER_SIZE (64 * 1024)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+///
+/// \brief A file created through the mount point
+///
+/// Created files live in the output directory of the HostFiles plugin, which s2e_stat does not see, so their
+/// attributes are tracked here. Entries are never freed, a name can only be created once.
+///
+struct created_file_t {
+    struct created_file_t *next;
+    char *path;
+    uint64_t size;
+    time_t mtime;
+};
+
+static struct created_file_t *s_created = NULL;
+static pthread_mutex_t s_created_lock = PTHREAD_MUTEX_INITIALIZER;
+
+///
+/// \brief An open file
+///
+/// Files opened for reading keep the data that was read ahead in the buffer. Files opened for writing collect
+/// contiguous writes in it until WRITE_BEHIND_SIZE bytes are pending.
+///
+struct open_file_t {
+    pthread_mutex_t lock;
+    int fd;
+    int writing;
+    struct created_file_t *created;
+
+    // Offset of the host descriptor, so that sequential accesses need no seek
+    uint64_t host_offset;
+
+    char *buf;
+    size_t buf_size;
+
+    // The buffer holds buf_len bytes of the file starting at buf_offset
+    uint64_t buf_offset;
+    size_t buf_len;
+
+    // Size of the next readahead
+    size_t window;
+
+    // First error of a delayed write, reported by the next write, flush or fsync
+    int error;
+};
+
+static const char *host_path(const char *path) {
+    // HostFiles paths are relative to the base directory
+    return path[1] ? path + 1 : ".";
+}
+
+static struct created_file_t *find_created(const char *path) {
+    struct created_file_t *created;
+
+    pthread_mutex_lock(&s_created_lock);
+    for (created = s_created; created; created = created->next) {
+        if (!strcmp(created->path, path)) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_created_lock);
+
+    return created;
+}
+
+static struct open_file_t *get_file(struct fuse_file_info *fi) {
+    return (struct open_file_t *) (uintptr_t) fi->fh;
+}
+
+static int s2efs_getattr(const char *path, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_nlink = 1;
+
+    struct created_file_t *created = find_created(path);
+    if (created) {
+        pthread_mutex_lock(&s_created_lock);
+        st->st_size = created->size;
+        st->st_mtime = created->mtime;
+        pthread_mutex_unlock(&s_created_lock);
+
+        st->st_mode = S_IFREG | 0644;
+        return 0;
+    }
+
+    struct S2E_HOSTFILES_STAT host_st;
+    if (strcmp(path, "/") && s2e_stat_metadata(host_path(path), &host_st) == 0) {
+        st->st_mode = S_IFREG | 0444;
+        st->st_size = host_st.size;
+        st->st_mtime = host_st.mtime;
+        return 0;
+    }
+
+    // Directories cannot be stat'ed, but they can be listed
+    char buf[256];
+    uint64_t cookie = 0;
+    if (s2e_listdir(host_path(path), buf, sizeof(buf), &cookie) >= 0) {
+        st->st_mode = S_IFDIR | 0755;
+        st->st_nlink = 2;
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+static int s2efs_readdir(const char *path, void *data, fuse_fill_dir_t filler, off_t offset,
+                         struct fuse_file_info *fi) {
+    int retval = -EIO;
+    uint64_t cookie = 0;
+
+    char *buf = malloc(LISTDIR_BUFFER_SIZE);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    filler(data, ".", NULL, 0);
+    filler(data, "..", NULL, 0);
+
+    while (1) {
+        int count = s2e_listdir(host_path(path), buf, LISTDIR_BUFFER_SIZE, &cookie);
+        if (count < 0) {
+            goto end;
+        } else if (count == 0) {
+            break;
+        }
+
+        const char *entry = buf;
+        const char *buf_end = buf + LISTDIR_BUFFER_SIZE;
+        for (int i = 0; i < count; ++i) {
+            // Do not trust the host to have stayed within the buffer
+            const char *name_end = entry + 1 < buf_end ? memchr(entry + 1, 0, buf_end - entry - 1) : NULL;
+            if (!name_end) {
+                goto end;
+            }
+
+            struct stat st;
+            memset(&st, 0, sizeof(st));
+            st.st_mode = entry[0] == S2E_HOSTFILES_DT_DIR ? S_IFDIR : S_IFREG;
+
+            if (filler(data, entry + 1, &st, 0)) {
+                // The kernel buffer is full
+                retval = 0;
+                goto end;
+            }
+
+            entry = name_end + 1;
+        }
+    }
+
+    retval = 0;
+
+end:
+    free(buf);
+    return retval;
+}
+
+static struct open_file_t *open_file_create(int fd, int writing, size_t buf_size) {
+    struct open_file_t *file = calloc(1, sizeof(*file));
+    if (!file) {
+        return NULL;
+    }
+
+    if (buf_size && !(file->buf = malloc(buf_size))) {
+        free(file);
+        return NULL;
+    }
+
+    pthread_mutex_init(&file->lock, NULL);
+    file->fd = fd;
+    file->writing = writing;
+    file->buf_size = buf_size;
+    file->window = READAHEAD_MIN;
+    return file;
+}
+
+static int create_file(const char *path, struct fuse_file_info *fi) {
+    // s2e_create fails if the file already exists in the output directory
+    int fd = s2e_create(host_path(path));
+    if (fd < 0) {
+        return -EEXIST;
+    }
+
+    struct created_file_t *created = calloc(1, sizeof(*created));
+    struct open_file_t *file = open_file_create(fd, 1, WRITE_BEHIND_SIZE);
+    if (!created || !file || !(created->path = strdup(path))) {
+        free(created);
+        if (file) {
+            free(file->buf);
+            free(file);
+        }
+        s2e_close(fd);
+        return -ENOMEM;
+    }
+
+    created->mtime = time(NULL);
+    pthread_mutex_lock(&s_created_lock);
+    created->next = s_created;
+    s_created = created;
+    pthread_mutex_unlock(&s_created_lock);
+
+    file->created = created;
+    fi->fh = (uintptr_t) file;
+    return 0;
+}
+
+static int s2efs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    return create_file(path, fi);
+}
+
+static int s2efs_open(const char *path, struct fuse_file_info *fi) {
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        // Host files cannot be modified in place, they can only be replaced by a new file in the output directory
+        return fi->flags & O_TRUNC ? create_file(path, fi) : -EACCES;
+    }
+
+    int fd = s2e_open(host_path(path));
+    if (fd < 0) {
+        return -ENOENT;
+    }
+
+    // The buffer grows with the readahead window
+    struct open_file_t *file = open_file_create(fd, 0, 0);
+    if (!file) {
+        s2e_close(fd);
+        return -ENOMEM;
+    }
+
+    fi->fh = (uintptr_t) file;
+
+    // Host files do not change during the analysis, let the kernel keep their pages cached across opens
+    fi->keep_cache = 1;
+    return 0;
+}
+
+static int seek_host(struct open_file_t *file, uint64_t offset) {
+    if (file->host_offset == offset) {
+        return 0;
+    }
+
+    if (s2e_seek(file->fd, offset, SEEK_SET) != (int64_t) offset) {
+        // The HostFiles plugin does not support seeking
+        return -ESPIPE;
+    }
+
+    file->host_offset = offset;
+    return 0;
+}
+
+///
+/// \brief Read the host file into the buffer, starting at the given offset
+///
+/// Reads that continue where the buffer ends are considered sequential and double the readahead window. Any other
+/// read starts over with the smallest window.
+///
+/// \return the number of bytes read, 0 at the end of the file, or a negative error number
+///
+static int fill_readahead(struct open_file_t *file, uint64_t offset, size_t size) {
+    if (file->buf_len && offset == file->buf_offset + file->buf_len) {
+        file->window = MIN(file->window * 2, READAHEAD_MAX);
+    } else {
+        file->window = READAHEAD_MIN;
+    }
+
+    size_t count = MAX(size, file->window);
+    if (count > file->buf_size) {
+        char *buf = realloc(file->buf, count);
+        if (!buf) {
+            return -ENOMEM;
+        }
+        file->buf = buf;
+        file->buf_size = count;
+    }
+
+    file->buf_len = 0;
+
+    int ret = seek_host(file, offset);
+    if (ret < 0) {
+        return ret;
+    }
+
+    size_t len = 0;
+    while (len < count) {
+        int read = s2e_read(file->fd, file->buf + len, MIN(count - len, INT_MAX));
+        if (read < 0) {
+            return -EIO;
+        } else if (read == 0) {
+            break;
+        }
+        len += read;
+    }
+
+    file->host_offset += len;
+    file->buf_offset = offset;
+    file->buf_len = len;
+    return len;
+}
+
+static int s2efs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    struct open_file_t *file = get_file(fi);
+    if (file->writing) {
+        return -EBADF;
+    }
+
+    pthread_mutex_lock(&file->lock);
+
+    size_t done = 0;
+    int ret = 0;
+    while (done < size) {
+        uint64_t pos = offset + done;
+        if (pos >= file->buf_offset && pos < file->buf_offset + file->buf_len) {
+            size_t count = MIN(size - done, file->buf_offset + file->buf_len - pos);
+            memcpy(buf + done, file->buf + (pos - file->buf_offset), count);
+            done += count;
+            continue;
+        }
+
+        ret = fill_readahead(file, pos, size - done);
+        if (ret <= 0) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&file->lock);
+
+    // Report errors only if no data could be read
+    return done || ret >= 0 ? (int) done : ret;
+}
+
+static int write_host(struct open_file_t *file, const char *buf, size_t size, uint64_t offset) {
+    int ret = seek_host(file, offset);
+    if (ret < 0) {
+        return ret;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        int written = s2e_write(file->fd, (char *) buf + done, MIN(size - done, INT_MAX));
+        if (written <= 0) {
+            return -EIO;
+        }
+        done += written;
+    }
+
+    file->host_offset += done;
+    return 0;
+}
+
+static int flush_writes(struct open_file_t *file) {
+    if (!file->error && file->buf_len) {
+        file->error = write_host(file, file->buf, file->buf_len, file->buf_offset);
+    }
+
+    file->buf_len = 0;
+    return file->error;
+}
+
+static int s2efs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    struct open_file_t *file = get_file(fi);
+    if (!file->writing) {
+        return -EBADF;
+    }
+
+    pthread_mutex_lock(&file->lock);
+
+    int ret = file->error;
+
+    // Only contiguous writes are collected
+    if (!ret && file->buf_len &&
+        (offset != file->buf_offset + file->buf_len || file->buf_len + size > file->buf_size)) {
+        ret = flush_writes(file);
+    }
+
+    if (!ret && size >= file->buf_size) {
+        ret = write_host(file, buf, size, offset);
+    } else if (!ret) {
+        if (!file->buf_len) {
+            file->buf_offset = offset;
+        }
+        memcpy(file->buf + file->buf_len, buf, size);
+        file->buf_len += size;
+    }
+
+    if (!ret) {
+        pthread_mutex_lock(&s_created_lock);
+        file->created->size = MAX(file->created->size, offset + size);
+        file->created->mtime = time(NULL);
+        pthread_mutex_unlock(&s_created_lock);
+    }
+
+    pthread_mutex_unlock(&file->lock);
+
+    return ret ? ret : (int) size;
+}
+
+static int s2efs_flush(const char *path, struct fuse_file_info *fi) {
+    struct open_file_t *file = get_file(fi);
+    if (!file->writing) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&file->lock);
+    int ret = flush_writes(file);
+    pthread_mutex_unlock(&file->lock);
+    return ret;
+}
+
+static int s2efs_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
+    return s2efs_flush(path, fi);
+}
+
+static int s2efs_release(const char *path, struct fuse_file_info *fi) {
+    struct open_file_t *file = get_file(fi);
+
+    if (file->writing) {
+        flush_writes(file);
+    }
+
+    s2e_close(file->fd);
+    pthread_mutex_destroy(&file->lock);
+    free(file->buf);
+    free(file);
+    return 0;
+}
+
+static int s2efs_truncate(const char *path, off_t size) {
+    // Created files can only grow by writing to them
+    struct created_file_t *created = find_created(path);
+    if (!created) {
+        return -EROFS;
+    }
+
+    pthread_mutex_lock(&s_created_lock);
+    int ret = (uint64_t) size == created->size ? 0 : -EPERM;
+    pthread_mutex_unlock(&s_created_lock);
+    return ret;
+}
+
+static int s2efs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi) {
+    return s2efs_truncate(path, size);
+}
+
+static void *s2efs_init(struct fuse_conn_info *conn) {
+#ifdef FUSE_CAP_ATOMIC_O_TRUNC
+    // Pass O_TRUNC to open instead of truncating host files first
+    conn->want |= FUSE_CAP_ATOMIC_O_TRUNC;
+#endif
+#ifdef FUSE_CAP_BIG_WRITES
+    // Let the kernel send writes larger than a page, so that fewer of them need to be collected
+    conn->want |= FUSE_CAP_BIG_WRITES;
+#endif
+    return NULL;
+}
+
+static struct fuse_operations s_operations = {
+    .getattr = s2efs_getattr,
+    .readdir = s2efs_readdir,
+    .create = s2efs_create,
+    .open = s2efs_open,
+    .read = s2efs_read,
+    .write = s2efs_write,
+    .flush = s2efs_flush,
+    .fsync = s2efs_fsync,
+    .release = s2efs_release,
+    .truncate = s2efs_truncate,
+    .ftruncate = s2efs_ftruncate,
+    .init = s2efs_init,
+};
+
+int main(int argc, char **argv) {
+    int help = argc < 2;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            help = 1;
+        }
+    }
+
+    if (help) {
+        fprintf(stderr, "Usage: %s mountpoint [FUSE options]\n", argv[0]);
+        fprintf(stderr, "Mounts the base directory of the HostFiles plugin at mountpoint. Files created in it are "
+                        "uploaded to the HostFiles output directory\n");
+    } else {
+        // Listing the FUSE options does not require S2E
+        printf("Waiting for S2E mode...\n");
+        s2e_wait_for_mode(-1);
+        printf("... S2E mode detected\n");
+    }
+
+    return fuse_main(argc, argv, &s_operations, NULL);
+}
@@ -40,8 +40,51 @@ SECRET_MESSAGE_SAVEVM='?!?MAGIC?!?s ready '
 # start executing it immediately.
 echo "booted kernel $(uname -r)" > /dev/ttyS0
 
+# Payloads listed in prefetch.manifest on the host are fetched into
+# $PREFETCH_DIR before the snapshot is taken, so that resuming from the snapshot
+# does not transfer them again. The manifest uses the format of
+# s2eget --manifest. If it fetches a prefetch.sh script, that script is run in
+# $PREFETCH_DIR to unpack the payloads. bootstrap.sh finds them in $PREFETCH_DIR.
+#
+# The manifest that was used is saved in $PREFETCH_STAMP. On resume, the host
+# manifest is fetched again and the prefetch is redone if it changed, e.g., when
+# a version comment is bumped after the payloads were updated.
+PREFETCH_DIR="$(pwd)/prefetch"
+PREFETCH_STAMP="$(pwd)/prefetch.stamp"
+export PREFETCH_DIR
+
+prefetch() {
+    rm -rf "$PREFETCH_DIR" "$PREFETCH_STAMP"
+    mkdir -p "$PREFETCH_DIR" || return 1
+
+    (
+        cd "$PREFETCH_DIR" || exit 1
+        ../s2eget --manifest "$1" || exit 1
+        if [ -f prefetch.sh ]; then
+            chmod +x prefetch.sh && ./prefetch.sh
+        fi
+    ) 2>&1 > /dev/ttyS0 || return 1
+
+    cp "$1" "$PREFETCH_STAMP"
+}
+
+fetch_prefetch_manifest() {
+    ./s2eget -o "$1" prefetch.manifest > /dev/null 2>&1
+}
+
+# Outside of S2E mode s2eget waits forever, so only prefetch when the snapshot
+# is taken in S2E mode.
+if ./s2ecmd check && fetch_prefetch_manifest prefetch.manifest; then
+    prefetch "$(pwd)/prefetch.manifest" || echo "prefetch failed" > /dev/ttyS0
+fi
+
 echo "$SECRET_MESSAGE_SAVEVM" > /dev/ttyS0
 
+if fetch_prefetch_manifest prefetch.manifest.new && ! cmp -s prefetch.manifest.new "$PREFETCH_STAMP"; then
+    echo "prefetch is stale, refreshing" > /dev/ttyS0
+    prefetch "$(pwd)/prefetch.manifest.new" || echo "prefetch failed" > /dev/ttyS0
+fi
+
 ./s2eget bootstrap.sh
 chmod +x bootstrap.sh
 ./bootstrap.sh 2>&1 > /dev/ttyS0